@@ -0,0 +1,250 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Fault injection, preloaded into espeakup by the recovery benchmark.
+ * ESPEAKUP_FAULT=<fault>[:<ms>] selects the fault, which is injected
+ * from the first text containing ESPEAKUP_FAULT_TRIGGER ("FAULT" by
+ * default) on, for <ms> milliseconds, or for good:
+ *
+ *   buffer-full     espeak_Synth fails with EE_BUFFER_FULL
+ *   internal-error  espeak_Synth fails with EE_INTERNAL_ERROR; without a
+ *                   duration, until espeak-ng is initialized again
+ *   hang-cancel     espeak_Cancel hangs
+ *   wedge-pcm       snd_pcm_writei hangs
+ *   no-device       the sound device is gone: snd_pcm_open and
+ *                   snd_pcm_writei fail with ENODEV
+ *
+ * ESPEAKUP_FAULT_DEVICE=<name> opens the ALSA device <name>, such as
+ * "null", instead of the one asked for.
+ *
+ * The fault is shared by the engine processes espeakup --standby starts,
+ * so that it hits the standby engine as well once triggered.  They run
+ * espeakup anew, and find the shared memory in ESPEAKUP_FAULT_SHARED.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <alsa/asoundlib.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <espeak-ng/speak_lib.h>
+
+enum fault_t
+{
+	FAULT_NONE,
+	FAULT_BUFFER_FULL,
+	FAULT_INTERNAL_ERROR,
+	FAULT_HANG_CANCEL,
+	FAULT_WEDGE_PCM,
+	FAULT_NO_DEVICE,
+};
+
+static const char *const faultNames[] = {
+	[FAULT_BUFFER_FULL] = "buffer-full",
+	[FAULT_INTERNAL_ERROR] = "internal-error",
+	[FAULT_HANG_CANCEL] = "hang-cancel",
+	[FAULT_WEDGE_PCM] = "wedge-pcm",
+	[FAULT_NO_DEVICE] = "no-device",
+};
+
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+static enum fault_t fault = FAULT_NONE;
+static long long duration_ns;           // 0 for good
+static const char *trigger = "FAULT";
+static const char *device;
+
+/* When the fault was triggered, 0 if it was not, -1 once it is over, in
+ * memory shared with the children. */
+static atomic_llong private_armed;
+static atomic_llong *armed = &private_armed;
+
+static long long monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+__attribute__((constructor)) static void share(void)
+{
+	const char *shared = getenv("ESPEAKUP_FAULT_SHARED");
+	char buf[16];
+	void *p;
+	int fd;
+
+	if (shared) {
+		fd = atoi(shared);
+	} else {
+		// Kept open across exec, for the engines.
+		fd = memfd_create("espeakup-faults", 0);
+		if (fd < 0 || ftruncate(fd, sizeof(*armed)) < 0)
+			return;
+		snprintf(buf, sizeof(buf), "%d", fd);
+		setenv("ESPEAKUP_FAULT_SHARED", buf, 1);
+	}
+	p = mmap(NULL, sizeof(*armed), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+	         0);
+	if (p != MAP_FAILED)
+		armed = p;
+}
+
+static void setup(void)
+{
+	const char *s = getenv("ESPEAKUP_FAULT");
+	size_t i, n;
+
+	if (getenv("ESPEAKUP_FAULT_TRIGGER"))
+		trigger = getenv("ESPEAKUP_FAULT_TRIGGER");
+	device = getenv("ESPEAKUP_FAULT_DEVICE");
+	if (!s)
+		return;
+	n = strcspn(s, ":");
+	for (i = 1; i < sizeof(faultNames) / sizeof(faultNames[0]); i++)
+		if (strlen(faultNames[i]) == n && !strncmp(s, faultNames[i], n))
+			fault = i;
+	if (fault == FAULT_NONE) {
+		fprintf(stderr, "faults: unknown fault %s\n", s);
+		exit(1);
+	}
+	if (s[n] == ':')
+		duration_ns = atoll(s + n + 1) * 1000000LL;
+}
+
+/* Look up the real function, into the function pointer at real, in the
+ * way POSIX recommends for dlsym. */
+static void next(void *real, const char *symbol)
+{
+	void *f = dlsym(RTLD_NEXT, symbol);
+
+	if (!f) {
+		fprintf(stderr, "faults: %s not found\n", symbol);
+		abort();
+	}
+	*(void **) real = f;
+}
+
+// Whether the fault f is being injected now.
+static int injecting(enum fault_t f)
+{
+	long long since;
+
+	pthread_once(&setup_once, setup);
+	if (fault != f)
+		return 0;
+	since = atomic_load(armed);
+	if (since <= 0)
+		return 0;
+	if (duration_ns && monotonic_ns() - since >= duration_ns) {
+		atomic_store(armed, -1);
+		return 0;
+	}
+	return 1;
+}
+
+// Hang for the rest of the fault.
+static void hang(enum fault_t f)
+{
+	struct timespec ts = {0, 1000000};
+
+	while (injecting(f))
+		nanosleep(&ts, NULL);
+}
+
+espeak_ERROR espeak_Synth(const void *text, size_t size,
+                          unsigned int position,
+                          espeak_POSITION_TYPE position_type,
+                          unsigned int end_position, unsigned int flags,
+                          unsigned int *unique_identifier, void *user_data)
+{
+	static espeak_ERROR (*real)(const void *, size_t, unsigned int,
+	                            espeak_POSITION_TYPE, unsigned int,
+	                            unsigned int, unsigned int *, void *);
+	long long zero = 0;
+
+	if (!real)
+		next(&real, "espeak_Synth");
+	pthread_once(&setup_once, setup);
+	if (fault != FAULT_NONE && memmem(text, size, trigger, strlen(trigger)))
+		atomic_compare_exchange_strong(armed, &zero, monotonic_ns());
+	if (injecting(FAULT_BUFFER_FULL))
+		return EE_BUFFER_FULL;
+	if (injecting(FAULT_INTERNAL_ERROR))
+		return EE_INTERNAL_ERROR;
+	return real(text, size, position, position_type, end_position, flags,
+	            unique_identifier, user_data);
+}
+
+int espeak_Initialize(espeak_AUDIO_OUTPUT output, int buflength,
+                      const char *path, int options)
+{
+	static int (*real)(espeak_AUDIO_OUTPUT, int, const char *, int);
+
+	if (!real)
+		next(&real, "espeak_Initialize");
+	pthread_once(&setup_once, setup);
+	// A restart is what clears a lasting internal error.
+	if (fault == FAULT_INTERNAL_ERROR && !duration_ns &&
+	    atomic_load(armed) > 0)
+		atomic_store(armed, -1);
+	return real(output, buflength, path, options);
+}
+
+espeak_ERROR espeak_Cancel(void)
+{
+	static espeak_ERROR (*real)(void);
+
+	if (!real)
+		next(&real, "espeak_Cancel");
+	hang(FAULT_HANG_CANCEL);
+	return real();
+}
+
+snd_pcm_sframes_t snd_pcm_writei(snd_pcm_t *pcm, const void *buffer,
+                                 snd_pcm_uframes_t size)
+{
+	static snd_pcm_sframes_t (*real)(snd_pcm_t *, const void *,
+	                                 snd_pcm_uframes_t);
+
+	if (!real)
+		next(&real, "snd_pcm_writei");
+	hang(FAULT_WEDGE_PCM);
+	if (injecting(FAULT_NO_DEVICE))
+		return -ENODEV;
+	return real(pcm, buffer, size);
+}
+
+int snd_pcm_open(snd_pcm_t **pcm, const char *name, snd_pcm_stream_t stream,
+                 int mode)
+{
+	static int (*real)(snd_pcm_t **, const char *, snd_pcm_stream_t, int);
+
+	if (!real)
+		next(&real, "snd_pcm_open");
+	if (injecting(FAULT_NO_DEVICE))
+		return -ENODEV;
+	return real(pcm, device ? device : name, stream, mode);
+}
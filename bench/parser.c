@@ -0,0 +1,205 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Benchmark of the softsynth protocol parser, on generated corpora: plain
+ * text, text dense with commands and index marks, and text with frequent
+ * flushes, in both modes.  More corpora can be given as files.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parser.h"
+#include "stringhandling.h"
+
+// Size of the generated corpora
+#define CORPUS_SIZE (4 * 1024 * 1024)
+
+// Keep going until each measurement took that long, in nanoseconds.
+#define MIN_TIME_NS 500000000LL
+
+/* speakup hands over what accumulated since the last read: usually a few
+ * hundred bytes, the whole screen when reviewing. */
+static size_t readSize = 512;
+
+static struct {
+	unsigned long entries;
+	unsigned long text_bytes;
+	unsigned long flushes;
+} counts;
+
+static void count_text(void *data, const char *txt, size_t length)
+{
+	counts.entries++;
+	counts.text_bytes += length;
+}
+
+static void count_command(void *data, enum command_t cmd, enum adjust_t adj,
+                          int value)
+{
+	counts.entries++;
+}
+
+static void count_flush(void *data)
+{
+	counts.flushes++;
+}
+
+static const struct parser_callbacks_t count_callbacks = {
+	.text = count_text,
+	.command = count_command,
+	.flush = count_flush,
+};
+
+static const char *words[] = {
+	"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+	"speakup", "reads", "console", "screen", "naïve", "café", "word",
+};
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+static const char *separators[] = {
+	" ", " ", " ", " ", " ", ", ", ". ", "! ", "\n",
+};
+#define NSEPARATORS (sizeof(separators) / sizeof(separators[0]))
+
+enum corpus_t
+{
+	CORPUS_PLAIN,     // prose, as when reading a document
+	CORPUS_DENSE,     // a command or mark around every word, as when reviewing
+	CORPUS_FLUSH,     // short texts cut by flushes, as when typing fast
+};
+
+static const char *corpus_names[] = { "plain", "dense", "flush" };
+
+static char *generate(enum corpus_t type, size_t *length)
+{
+	char *buf = allocMem(CORPUS_SIZE + 64);
+	unsigned int seed = 1;
+	size_t l = 0;
+	int mark = 0;
+
+	while (l < CORPUS_SIZE) {
+		seed = seed * 1103515245 + 12345;
+		l += sprintf(buf + l, "%s%s", words[(seed >> 16) % NWORDS],
+		             separators[(seed >> 8) % NSEPARATORS]);
+		switch (type) {
+		case CORPUS_DENSE:
+			l += sprintf(buf + l, "\001%di", mark++ % 1000);
+			if (seed & 0x100)
+				l += sprintf(buf + l, "\001%c%d%c",
+				             seed & 0x200 ? '+' : '-', (seed >> 4) % 10,
+				             "bfprsv"[(seed >> 20) % 6]);
+			break;
+		case CORPUS_FLUSH:
+			if ((seed >> 12) % 8 == 0)
+				buf[l++] = 0x18;
+			break;
+		default:
+			break;
+		}
+	}
+	*length = l;
+	return buf;
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void run(const char *name, enum espeakup_mode_t mode, const char *buf,
+                size_t length)
+{
+	struct parser_t *p;
+	long long start, elapsed;
+	unsigned long rounds = 0;
+	size_t off, n;
+	double seconds;
+
+	memset(&counts, 0, sizeof(counts));
+	start = now_ns();
+	do {
+		p = new_parser(mode, &count_callbacks, NULL);
+		for (off = 0; off < length; off += n) {
+			n = length - off < readSize ? length - off : readSize;
+			parser_feed(p, buf + off, n);
+		}
+		free_parser(p);
+		rounds++;
+		elapsed = now_ns() - start;
+	} while (elapsed < MIN_TIME_NS);
+
+	seconds = elapsed / 1e9;
+	printf("%-8s %-7s %9.1f MB/s %12.0f entries/s %10.0f flushes/s\n",
+	       name, mode == ESPEAKUP_MODE_SPEAKUP ? "speakup" : "acsint",
+	       rounds * length / seconds / 1e6, counts.entries / seconds,
+	       counts.flushes / seconds);
+}
+
+static char *read_file(const char *path, size_t *length)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf = NULL;
+	int l = 0;
+	char chunk[4096];
+	size_t n;
+
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	buf = initString(&l);
+	while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+		stringAndBytes(&buf, &l, chunk, n);
+	fclose(f);
+	*length = l;
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	enum corpus_t type;
+	char *buf;
+	size_t length;
+	int i;
+
+	if (getenv("PARSER_BENCH_READ_SIZE"))
+		readSize = atoi(getenv("PARSER_BENCH_READ_SIZE"));
+	if (readSize < 1 || readSize > PARSER_MAX_INPUT)
+		readSize = PARSER_MAX_INPUT;
+
+	for (type = CORPUS_PLAIN; type <= CORPUS_FLUSH; type++) {
+		buf = generate(type, &length);
+		run(corpus_names[type], ESPEAKUP_MODE_SPEAKUP, buf, length);
+		run(corpus_names[type], ESPEAKUP_MODE_ACSINT, buf, length);
+		free(buf);
+	}
+	for (i = 1; i < argc; i++) {
+		buf = read_file(argv[i], &length);
+		run(argv[i], ESPEAKUP_MODE_SPEAKUP, buf, length);
+		run(argv[i], ESPEAKUP_MODE_ACSINT, buf, length);
+		if (buf != EMPTYSTRING)
+			free(buf);
+	}
+	return 0;
+}
@@ -0,0 +1,353 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Benchmark of the recovery from failures of espeak-ng and of the sound
+ * device.  Runs espeakup in acsint mode with the fault injection shim
+ * preloaded, triggers each fault, and measures how long it takes until
+ * the index marks of the texts sent afterwards are reported, or until
+ * espeakup exits when the failure is beyond in-process recovery.  Also
+ * checks that no text is lost, and that espeakup does not busy-loop
+ * meanwhile.  Each scenario is run again with --standby, where a hung
+ * engine process is replaced by its standby.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Timeouts given to espeakup, in milliseconds, shorter than the defaults.
+#define STALL_TIMEOUT 1000
+#define STOP_TIMEOUT 1000
+#define MAX_RESTARTS 2
+#define STANDBY_TIMEOUT 500
+
+// How long to wait for espeakup to recover, or to exit, in milliseconds.
+#define PATIENCE 30000
+
+// Above this share of a CPU, espeakup is considered busy-looping.
+#define BUSY_CPU 0.25
+
+struct scenario_t {
+	const char *name;
+	const char *fault;
+	int flush;          // flush after the faulty text
+	int exits;          // espeakup is expected to exit with status 3
+	int exits_standby;  // the same, with --standby
+};
+
+static const struct scenario_t scenarios[] = {
+	{"no fault", NULL, 0, 0, 0},
+	{"transient EE_BUFFER_FULL", "buffer-full:500", 0, 0, 0},
+	{"transient EE_INTERNAL_ERROR", "internal-error:500", 0, 0, 0},
+	{"EE_INTERNAL_ERROR until restart", "internal-error", 0, 0, 0},
+	{"transiently wedged PCM", "wedge-pcm:1000", 0, 0, 0},
+	{"wedged PCM", "wedge-pcm", 0, 1, 1},
+	// Speech waits for the device, without switching engines.
+	{"sound device gone for a while", "no-device:3000", 0, 0, 0},
+	{"transiently hanging espeak_Cancel", "hang-cancel:500", 1, 0, 0},
+	// The standby engine takes over, without cancelling anything.
+	{"hanging espeak_Cancel", "hang-cancel", 1, 1, 0},
+};
+
+static const char *espeakup;
+static const char *shim;
+// Show what espeakup prints on its standard error.
+static int verbose = 0;
+
+// Whether to run espeakup with --standby.
+static int standby = 0;
+
+/* How long speaking the texts took without a fault, to tell the
+ * recovery time apart. */
+static long long baseline = -1;
+
+struct child_t {
+	pid_t pid;
+	int in;
+	int out;
+};
+
+static long long monotonic_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/* CPU time used by a process so far, and by its children which exited,
+ * in milliseconds, and its parent into ppid.  Returns -1 if it is gone. */
+static long long process_cpu_ms(pid_t pid, pid_t *ppid)
+{
+	char path[64];
+	char buf[1024];
+	unsigned long utime, stime;
+	long cutime, cstime;
+	int parent;
+	char *p;
+	FILE *f;
+	size_t n;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	n = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[n] = 0;
+	// Skip the command name, which may contain anything.
+	p = strrchr(buf, ')');
+	if (!p || sscanf(p + 2, "%*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+	                 "%lu %lu %ld %ld", &parent, &utime, &stime, &cutime,
+	                 &cstime) != 5)
+		return -1;
+	*ppid = parent;
+	return (utime + stime + cutime + cstime) * 1000LL /
+	       sysconf(_SC_CLK_TCK);
+}
+
+/* CPU time used by espeakup so far, in milliseconds, including its engine
+ * processes with --standby. */
+static long long cpu_ms(pid_t pid)
+{
+	long long total, cpu;
+	struct dirent *d;
+	pid_t ppid;
+	DIR *dir;
+
+	total = process_cpu_ms(pid, &ppid);
+	if (total < 0)
+		return 0;
+	dir = opendir("/proc");
+	if (!dir)
+		return total;
+	while ((d = readdir(dir)))
+		if (d->d_name[0] >= '1' && d->d_name[0] <= '9' &&
+		    (cpu = process_cpu_ms(atoi(d->d_name), &ppid)) >= 0 &&
+		    ppid == pid)
+			total += cpu;
+	closedir(dir);
+	return total;
+}
+
+static int start(struct child_t *c, const char *fault)
+{
+	int in[2], out[2];
+	char stall[32], stop[32], restarts[32], standby_timeout[32];
+
+	if (pipe(in) < 0 || pipe(out) < 0) {
+		perror("pipe");
+		return -1;
+	}
+	snprintf(stall, sizeof(stall), "--stall-timeout=%d", STALL_TIMEOUT);
+	snprintf(stop, sizeof(stop), "--stop-timeout=%d", STOP_TIMEOUT);
+	snprintf(restarts, sizeof(restarts), "--max-restarts=%d", MAX_RESTARTS);
+	snprintf(standby_timeout, sizeof(standby_timeout), "--standby=%d",
+	         STANDBY_TIMEOUT);
+	c->pid = fork();
+	if (c->pid < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (!c->pid) {
+		dup2(in[0], STDIN_FILENO);
+		dup2(out[1], STDOUT_FILENO);
+		close(in[0]);
+		close(in[1]);
+		close(out[0]);
+		close(out[1]);
+		if (!verbose) {
+			int devnull = open("/dev/null", O_WRONLY);
+			dup2(devnull, STDERR_FILENO);
+			if (devnull > 2)
+				close(devnull);
+		}
+		setenv("LD_PRELOAD", shim, 1);
+		if (fault)
+			setenv("ESPEAKUP_FAULT", fault, 1);
+		if (!getenv("ESPEAKUP_FAULT_DEVICE"))
+			setenv("ESPEAKUP_FAULT_DEVICE", "null", 1);
+		execl(espeakup, espeakup, "--acsint", "--config=/dev/null", stall,
+		      stop, restarts, standby ? standby_timeout : NULL,
+		      (char *) NULL);
+		perror(espeakup);
+		_exit(127);
+	}
+	close(in[0]);
+	close(out[1]);
+	c->in = in[1];
+	c->out = out[0];
+	return 0;
+}
+
+static void send(struct child_t *c, const char *s)
+{
+	if (write(c->in, s, strlen(s)) < 0)
+		perror("write");
+}
+
+/* Wait for the index mark expected, until the deadline.  Returns 1 if it
+ * came, 0 on timeout, -1 if espeakup closed its output, and -2 if
+ * another mark came instead. */
+static int wait_mark(struct child_t *c, int expected, long long deadline)
+{
+	struct pollfd pfd = {c->out, POLLIN, 0};
+	unsigned char mark;
+	long long now;
+
+	while ((now = monotonic_ms()) < deadline) {
+		if (poll(&pfd, 1, deadline - now) <= 0)
+			continue;
+		if (read(c->out, &mark, 1) != 1)
+			return -1;
+		return mark == expected ? 1 : -2;
+	}
+	return 0;
+}
+
+/* Wait for espeakup to exit, until the deadline.  Returns its exit status,
+ * or -1 on timeout. */
+static int wait_exit(struct child_t *c, long long deadline)
+{
+	int status;
+
+	while (monotonic_ms() < deadline) {
+		if (waitpid(c->pid, &status, WNOHANG) == c->pid)
+			return WIFEXITED(status) ? WEXITSTATUS(status) : 128;
+		usleep(10000);
+	}
+	return -1;
+}
+
+static void stop(struct child_t *c)
+{
+	close(c->in);
+	close(c->out);
+	kill(c->pid, SIGKILL);
+	waitpid(c->pid, NULL, 0);
+}
+
+static int run(const struct scenario_t *sc)
+{
+	struct child_t c;
+	long long t0, t, cpu0;
+	int ok = 1;
+	int mark;
+	int r;
+
+	if (start(&c, sc->fault) < 0)
+		return 0;
+	send(&c, "Warming up.\0011i\n");
+	if (wait_mark(&c, 1, monotonic_ms() + PATIENCE) != 1) {
+		printf("%-36s espeakup did not start speaking\n", sc->name);
+		stop(&c);
+		return 0;
+	}
+
+	cpu0 = cpu_ms(c.pid);
+	t0 = monotonic_ms();
+	send(&c, "FAULT injected here.\0012i\n");
+	if (sc->flush) {
+		usleep(100000);
+		send(&c, "\030");
+	}
+	send(&c, "Is anybody there?\0013i\n");
+	send(&c, "Still there.\0014i\n");
+
+	if (standby ? sc->exits_standby : sc->exits) {
+		/* A wedged device is only noticed once synthesis got the whole
+		 * of --audio-ahead in advance. */
+		send(&c, "This text goes on for a while, so that it takes more "
+		     "than the audio which synthesis may queue in advance of "
+		     "playback, and keeps espeak-ng waiting for room.\n");
+		r = wait_exit(&c, t0 + PATIENCE);
+		t = monotonic_ms() - t0;
+		if (r != 3) {
+			printf("%-36s did not exit with status 3 (%d)\n", sc->name, r);
+			ok = 0;
+		} else {
+			printf("%-36s exited after %lld ms\n", sc->name, t);
+		}
+		stop(&c);
+		return ok;
+	}
+
+	// A flush drops the faulty text, and its mark.
+	for (mark = sc->flush ? 3 : 2; mark <= 4; mark++) {
+		r = wait_mark(&c, mark, t0 + PATIENCE);
+		if (r != 1) {
+			printf("%-36s %s mark %d\n", sc->name,
+			       r == -2 ? "lost the text before" : "never reported",
+			       mark);
+			ok = 0;
+			break;
+		}
+	}
+	t = monotonic_ms() - t0;
+	if (ok && !sc->fault) {
+		baseline = t;
+		printf("%-36s spoken in %lld ms\n", sc->name, t);
+	} else if (ok) {
+		long long cpu = cpu_ms(c.pid) - cpu0;
+
+		printf("%-36s recovered after %lld ms", sc->name, t);
+		// A flush drops a text, which makes it meaningless.
+		if (baseline >= 0 && !sc->flush)
+			printf(" (%+lld ms)", t - baseline);
+		printf(", %lld ms of CPU\n", cpu);
+		if (cpu > t * BUSY_CPU) {
+			printf("%-36s busy-looping\n", "");
+			ok = 0;
+		}
+	}
+	stop(&c);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	int failed = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <espeakup> <faults.so>\n"
+		        "Set RECOVERY_BENCH_VERBOSE to see the messages of "
+		        "espeakup.\n", argv[0]);
+		return 2;
+	}
+	espeakup = argv[1];
+	shim = argv[2];
+	if (getenv("RECOVERY_BENCH_VERBOSE"))
+		verbose = 1;
+	signal(SIGPIPE, SIG_IGN);
+	for (standby = 0; standby <= 1; standby++) {
+		printf("%s:\n", standby ? "With --standby" : "Without --standby");
+		baseline = -1;
+		for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+			if (!run(&scenarios[i]))
+				failed++;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Fuzz target for the softsynth protocol parser, for libFuzzer, or AFL++
+ * through its libFuzzer driver (afl-clang-fast -fsanitize=fuzzer).  The
+ * first input byte selects the mode, the second one how the rest is cut
+ * into reads, and the parser output is checked as it comes.  Plain UTF-8
+ * text is also fed one byte at a time, and must come out as UTF-8 still,
+ * whatever the reads cut.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "parser.h"
+
+static enum espeakup_mode_t mode;
+static int check_utf8;
+
+/* Whether buf is made of whole UTF-8 characters.  Only the structure is
+ * checked, as the parser only knows about that. */
+static int valid_utf8(const uint8_t *buf, size_t length)
+{
+	size_t i = 0;
+	int need;
+
+	while (i < length) {
+		uint8_t c = buf[i];
+		if (c < 0x80)
+			need = 1;
+		else if ((c & 0xe0) == 0xc0)
+			need = 2;
+		else if ((c & 0xf0) == 0xe0)
+			need = 3;
+		else if ((c & 0xf8) == 0xf0)
+			need = 4;
+		else
+			return 0;
+		if (length - i < (size_t) need)
+			return 0;
+		for (i++; --need > 0; i++)
+			if ((buf[i] & 0xc0) != 0x80)
+				return 0;
+	}
+	return 1;
+}
+
+// Text only, without commands nor flushes, which may cut characters.
+static int plain_utf8(const uint8_t *buf, size_t length)
+{
+	size_t i;
+
+	for (i = 0; i < length; i++)
+		if (buf[i] < ' ' && buf[i] != '\n')
+			return 0;
+	return valid_utf8(buf, length);
+}
+
+static void check_text(void *data, const char *txt, size_t length)
+{
+	size_t i;
+
+	if (length == 0)
+		abort();
+	for (i = 0; i < length; i++) {
+		char c = txt[i];
+		// Control characters are never spoken.
+		if (c >= 0 && c < ' ' &&
+		    (c != '\n' || mode == ESPEAKUP_MODE_ACSINT))
+			abort();
+	}
+	if (check_utf8 && !valid_utf8((const uint8_t *) txt, length))
+		abort();
+}
+
+static void check_command(void *data, enum command_t cmd, enum adjust_t adj,
+                          int value)
+{
+	if (cmd >= CMD_UNKNOWN || cmd == CMD_SPEAK_TEXT || cmd == CMD_FLUSH)
+		abort();
+	if (adj != ADJ_DEC && adj != ADJ_SET && adj != ADJ_INC)
+		abort();
+	if (value < 0 || value >= 1000000)
+		abort();
+}
+
+static void check_flush(void *data)
+{
+}
+
+static const struct parser_callbacks_t check_callbacks = {
+	.text = check_text,
+	.command = check_command,
+	.flush = check_flush,
+};
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct parser_t *p;
+	size_t readSize, n, i;
+
+	if (size < 2)
+		return 0;
+	mode = data[0] & 1 ? ESPEAKUP_MODE_ACSINT : ESPEAKUP_MODE_SPEAKUP;
+	readSize = data[1] + 1;
+	data += 2;
+	size -= 2;
+
+	check_utf8 = plain_utf8(data, size);
+
+	p = new_parser(mode, &check_callbacks, NULL);
+	for (i = 0; i < size; i += n) {
+		n = size - i < readSize ? size - i : readSize;
+		parser_feed(p, (const char *) data + i, n);
+	}
+	free_parser(p);
+
+	if (check_utf8) {
+		p = new_parser(mode, &check_callbacks, NULL);
+		for (i = 0; i < size; i++)
+			parser_feed(p, (const char *) data + i, 1);
+		free_parser(p);
+	}
+	return 0;
+}
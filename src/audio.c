@@ -0,0 +1,725 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Audio output.  Espeak runs in retrieval mode and hands us the
+ * synthesized samples, which are queued here in a lock-free ring (see
+ * ring.c) along with the index marks.  A dedicated playback thread drains
+ * the ring to ALSA, and reports each mark once the samples before it have
+ * actually been played.
+ *
+ * Only the playback thread touches the ALSA device.  The espeak thread
+ * produces, and flushes by making the ring read position jump to the
+ * write position; the playback thread notices the jump and drops what
+ * ALSA still has buffered.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <alsa/asoundlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "espeakup.h"
+#include "realtime.h"
+#include "resample.h"
+#include "ring.h"
+#include "stats.h"
+#include "stringhandling.h"
+#include "watchdog.h"
+
+/* ALSA devices to play on, separated by commas, in order of preference:
+ * when one fails, playback goes on with the next one that works, and
+ * goes back to a preferred one when sound devices show up. */
+char *audioDevices = "default";
+#define MAX_DEVICES 8
+
+/* Latency requested from ALSA, in milliseconds */
+int audioLatency = 100;
+
+/* How far synthesis may get ahead of playback, in milliseconds.  This
+ * does not affect how fast a flush is. */
+int audioAhead = 1000;
+#define AUDIO_RING_MARKS 256
+
+/* Rate to open the device at, doing the resampling here rather than in
+ * ALSA, or 0 to play at the espeak-ng rate and leave resampling to ALSA.
+ * The device may end up at another rate, the closest it supports. */
+int audioResample = 0;
+
+/* Samples are handed to ALSA in pieces of audioPeriod milliseconds, which
+ * bounds how long a flush may have to wait for the playback thread. */
+int audioPeriod = 20;
+
+/* How long synthesis waits for playback to make room in the ring before
+ * giving up on the audio output, in milliseconds. */
+static const int audioStallMs = 2000;
+
+/* How long the playback thread sleeps while waiting for the device to
+ * play up to a mark, in nanoseconds */
+static const long audioPollNs = 5000000;
+
+/* How long playback waits before trying failed devices again, in
+ * milliseconds, unless sound devices show up meanwhile */
+static const int audioRetryMs = 200;
+
+static struct pcm_ring_t *ring = NULL;
+static atomic_int audio_rate;
+
+/* Requests from the espeak thread to the playback thread */
+static atomic_int flush_count;
+static atomic_int close_requested;
+static atomic_int close_now;
+
+/* When the pending flush was requested, to measure how long it takes to
+ * silence the output. */
+static atomic_llong stop_time;
+static struct duration_stats_t cancel_stats;
+
+/* When input came in after an idle period, to measure how long it takes
+ * to get the first audio out. */
+static atomic_llong wakeup_time;
+static struct duration_stats_t wakeup_stats;
+
+/* Wakeup of the playback thread when it has nothing to do.  The producer
+ * only takes the mutex when the playback thread is actually waiting. */
+static pthread_mutex_t audio_guard = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t audio_wake = PTHREAD_COND_INITIALIZER;
+static atomic_int player_waiting;
+
+/* Wakeup of the producer when the ring is full, the other way round.  Uses
+ * the monotonic clock, initialized along with the ring. */
+static pthread_cond_t room_wake;
+static atomic_int producer_waiting;
+
+/* Set while none of the devices can be opened: synthesis then waits for
+ * one to show up, rather than giving up on the audio output. */
+static atomic_int no_device;
+
+/* Playback thread state */
+static char *devices[MAX_DEVICES];
+static int ndevices;
+static int device;          // the one open, an index in devices
+static int failed_device = -1; // the one playing last failed on, or -1
+static int dev_snd_fd = -1; // inotify on /dev/snd, or -1
+static long long failed_since; // when playing started failing, or 0
+static struct duration_stats_t failover_stats;
+static snd_pcm_t *pcm = NULL;
+static int pcm_rate;        // rate of the samples in the ring
+static int device_rate;     // rate the device plays at
+static int pcm_failing;     // do not repeat the same error over and over
+
+/* Resampling from pcm_rate to device_rate, when they differ, and the CPU
+ * time it took for how many input samples. */
+#define RESAMPLE_PIECE 256
+static struct resampler_t *resampler = NULL;
+static short *resample_buf;
+static long long resample_ns;
+static long resampled;
+
+static void short_sleep(long ns)
+{
+	struct timespec ts = {0, ns};
+	nanosleep(&ts, NULL);
+}
+
+static void wake_player(void)
+{
+	// Pairs with the fence in have_work.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load(&player_waiting))
+		return;
+	pthread_mutex_lock(&audio_guard);
+	pthread_cond_signal(&audio_wake);
+	pthread_mutex_unlock(&audio_guard);
+}
+
+static void wake_producer(void)
+{
+	// Pairs with the fence in wait_for_room.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load(&producer_waiting))
+		return;
+	pthread_mutex_lock(&audio_guard);
+	pthread_cond_signal(&room_wake);
+	pthread_mutex_unlock(&audio_guard);
+}
+
+/* Open the device for playing samples at the given rate.  The device is
+ * opened by the playback thread when there is something to play. */
+int audio_open(int rate)
+{
+	if (!ring) {
+		pthread_condattr_t attr;
+
+		ring = new_pcm_ring(rate * audioAhead / 1000, AUDIO_RING_MARKS);
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&room_wake, &attr);
+		pthread_condattr_destroy(&attr);
+	}
+	atomic_store(&audio_rate, rate);
+	atomic_store(&close_requested, 0);
+	return 0;
+}
+
+/* Release the device once everything queued has been played. */
+void audio_close(void)
+{
+	atomic_store(&close_requested, 1);
+	wake_player();
+}
+
+/* Close the device right away, dropping what was not played yet, and
+ * wait for the playback thread to have closed it, so that a restart of
+ * espeak-ng starts over with the device.  Gives up after audioStallMs if
+ * playback is stuck in ALSA: the device is then closed once it is not. */
+void audio_close_now(void)
+{
+	struct timespec deadline;
+	int err = 0;
+
+	if (!ring)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += audioStallMs / 1000;
+	deadline.tv_nsec += audioStallMs % 1000 * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	atomic_store(&close_now, 1);
+	audio_stop();
+	pthread_mutex_lock(&audio_guard);
+	atomic_store(&producer_waiting, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	while (atomic_load(&close_now) && should_run && err != ETIMEDOUT)
+		err = pthread_cond_timedwait(&room_wake, &audio_guard, &deadline);
+	atomic_store(&producer_waiting, 0);
+	pthread_mutex_unlock(&audio_guard);
+}
+
+/* Wait for the playback thread to make room in the ring: it wakes us up
+ * as soon as it has played something.  Returns 1 if there is room, 0 if
+ * a flush or a shutdown is requested meanwhile, and -1 if playback is
+ * stuck. */
+static int wait_for_room(void)
+{
+	uint64_t read = pcm_ring_read_pos(ring);
+	struct timespec deadline;
+	int err = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += audioStallMs / 1000;
+	deadline.tv_nsec += audioStallMs % 1000 * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&audio_guard);
+	atomic_store(&producer_waiting, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	while (pcm_ring_read_pos(ring) == read && !stop_requested && should_run &&
+	       err != ETIMEDOUT)
+		err = pthread_cond_timedwait(&room_wake, &audio_guard, &deadline);
+	atomic_store(&producer_waiting, 0);
+	pthread_mutex_unlock(&audio_guard);
+
+	if (stop_requested || !should_run)
+		return 0;
+	if (pcm_ring_read_pos(ring) != read)
+		return 1;
+	if (atomic_load(&no_device)) {
+		/* Keep everything queued until a device shows up: restarting
+		 * espeak-ng would not help. */
+		watchdog_progress();
+		engine_waiting();
+		return 1;
+	}
+	fprintf(stderr, "Audio output stalled\n");
+	espeak_output_stalled();
+	pcm_ring_flush(ring);
+	atomic_fetch_add(&flush_count, 1);
+	wake_player();
+	return -1;
+}
+
+/* Queue samples for playing, blocking while the ring is full. */
+int audio_write(const short *samples, int count)
+{
+	int n;
+	int rc;
+
+	while (count > 0) {
+		n = pcm_ring_write(ring, samples, count);
+		if (n) {
+			wake_player();
+			samples += n;
+			count -= n;
+			continue;
+		}
+		rc = wait_for_room();
+		if (rc <= 0)
+			return rc;
+	}
+	return 0;
+}
+
+/* Queue an index mark, to be reported once the samples queued so far have
+ * been played. */
+int audio_mark(int value)
+{
+	int rc;
+
+	while (!pcm_ring_add_mark(ring, value)) {
+		rc = wait_for_room();
+		if (rc <= 0)
+			return rc;
+	}
+	wake_player();
+	return 0;
+}
+
+/* Silence the output right away, dropping whatever is still queued. */
+void audio_stop(void)
+{
+	if (!ring)
+		return;
+	pcm_ring_flush(ring);
+	atomic_fetch_add(&flush_count, 1);
+	wake_player();
+}
+
+/* Note that a flush was requested: it is done later by audio_stop, from
+ * the espeak thread.  Called once stop_requested is set, to interrupt
+ * synthesis if it is waiting for room. */
+void audio_stop_requested(void)
+{
+	long long expected = 0;
+
+	atomic_compare_exchange_strong(&stop_time, &expected, monotonic_ns());
+	wake_producer();
+}
+
+/* Note that input came in after an idle period. */
+void audio_wakeup(void)
+{
+	atomic_store(&wakeup_time, monotonic_ns());
+}
+
+/* Where the audio queued so far ends, and how much of it was played, in
+ * samples. */
+uint64_t audio_queued_pos(void)
+{
+	return ring ? pcm_ring_write_pos(ring) : 0;
+}
+
+uint64_t audio_played_pos(void)
+{
+	return ring ? pcm_ring_read_pos(ring) : 0;
+}
+
+/* Let the playback thread notice a shutdown. */
+void audio_shutdown(void)
+{
+	pthread_mutex_lock(&audio_guard);
+	pthread_cond_signal(&audio_wake);
+	pthread_mutex_unlock(&audio_guard);
+}
+
+/* Set the device up at its native rate, as close as possible to
+ * audioResample, without ALSA resampling. */
+static int set_native_params(void)
+{
+	snd_pcm_hw_params_t *params;
+	unsigned int rate = audioResample;
+	unsigned int buffer_time = audioLatency * 1000;
+	unsigned int period_time = buffer_time / 4;
+	int err;
+
+	err = snd_pcm_hw_params_malloc(&params);
+	if (err < 0)
+		return err;
+	err = snd_pcm_hw_params_any(pcm, params);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_rate_resample(pcm, params, 0);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_access(pcm, params,
+		                                   SND_PCM_ACCESS_RW_INTERLEAVED);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_S16);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_channels(pcm, params, 1);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_rate_near(pcm, params, &rate, NULL);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_buffer_time_near(pcm, params,
+		                                             &buffer_time, NULL);
+	if (err >= 0)
+		err = snd_pcm_hw_params_set_period_time_near(pcm, params,
+		                                             &period_time, NULL);
+	if (err >= 0)
+		err = snd_pcm_hw_params(pcm, params);
+	snd_pcm_hw_params_free(params);
+	if (err < 0)
+		return err;
+	device_rate = rate;
+	return 0;
+}
+
+static int open_one_device(const char *name)
+{
+	snd_pcm_uframes_t buffer_size, period_size;
+	int err;
+
+	pcm_rate = atomic_load(&audio_rate);
+	err = snd_pcm_open(&pcm, name, SND_PCM_STREAM_PLAYBACK, 0);
+	if (err < 0) {
+		if (!pcm_failing)
+			fprintf(stderr, "ALSA open error on %s: %s\n", name,
+			        snd_strerror(err));
+		pcm = NULL;
+		return -1;
+	}
+	device_rate = pcm_rate;
+	if (audioResample)
+		err = set_native_params();
+	else
+		err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16,
+		                         SND_PCM_ACCESS_RW_INTERLEAVED, 1, pcm_rate, 1,
+		                         audioLatency * 1000);
+	if (err < 0) {
+		if (!pcm_failing)
+			fprintf(stderr, "ALSA setup error on %s: %s\n", name,
+			        snd_strerror(err));
+		snd_pcm_close(pcm);
+		pcm = NULL;
+		return -1;
+	}
+	if (device_rate != pcm_rate) {
+		resampler = new_resampler(pcm_rate, device_rate);
+		resample_buf = allocMem(
+			resampler_max_output(resampler, RESAMPLE_PIECE) * sizeof(short));
+	}
+	if (debug && snd_pcm_get_params(pcm, &buffer_size, &period_size) == 0)
+		printf("Audio output on %s at %d Hz%s: %.1f ms buffer, %.1f ms "
+		       "period\n", name, device_rate,
+		       resampler ? " (resampled)" : "",
+		       buffer_size * 1000.0 / device_rate,
+		       period_size * 1000.0 / device_rate);
+	return 0;
+}
+
+/* Open the first of the devices which works.  After playing failed, the
+ * search starts from the next device, and the failing one is tried last:
+ * a device may well open and then fail again. */
+static int open_device(void)
+{
+	int i;
+
+	for (i = 1; i <= ndevices; i++) {
+		device = (failed_device + i) % ndevices;
+		if (open_one_device(devices[device]) == 0) {
+			atomic_store(&no_device, 0);
+			return 0;
+		}
+	}
+	atomic_store(&no_device, 1);
+	return -1;
+}
+
+/* Split the device list, and watch for sound devices showing up. */
+static void setup_devices(void)
+{
+	char *list = dupeString(audioDevices);
+	char *name;
+
+	ndevices = 0;
+	for (name = strtok(list, ","); name && ndevices < MAX_DEVICES;
+	     name = strtok(NULL, ","))
+		devices[ndevices++] = name;
+	if (!ndevices)
+		devices[ndevices++] = "default";
+
+	dev_snd_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (dev_snd_fd >= 0 &&
+	    inotify_add_watch(dev_snd_fd, "/dev/snd", IN_CREATE | IN_ATTRIB) < 0) {
+		close(dev_snd_fd);
+		dev_snd_fd = -1;
+	}
+}
+
+/* Whether sound devices showed up, waiting for that up to timeout
+ * milliseconds.  Their permissions being set counts, as they cannot be
+ * opened until then. */
+static int devices_changed(int timeout)
+{
+	struct pollfd pfd = {dev_snd_fd, POLLIN, 0};
+	char buf[4096];
+	int changed = 0;
+
+	if (dev_snd_fd < 0) {
+		poll(NULL, 0, timeout);
+		return timeout > 0;
+	}
+	if (poll(&pfd, 1, timeout) <= 0)
+		return 0;
+	while (read(dev_snd_fd, buf, sizeof(buf)) > 0)
+		changed = 1;
+	return changed;
+}
+
+static void close_device(void)
+{
+	if (!pcm)
+		return;
+	snd_pcm_close(pcm);
+	pcm = NULL;
+	if (resampler) {
+		free_resampler(resampler);
+		free(resample_buf);
+		resampler = NULL;
+	}
+}
+
+static int write_device(const short *samples, int count)
+{
+	snd_pcm_sframes_t n;
+
+	while (count > 0) {
+		n = snd_pcm_writei(pcm, samples, count);
+		if (n < 0) {
+			/* Recover from underruns (which happen between utterances
+			 * anyway), suspends and interrupted calls. */
+			n = snd_pcm_recover(pcm, n, 1);
+			if (n < 0) {
+				if (!pcm_failing)
+					fprintf(stderr, "ALSA write error: %s\n",
+					        snd_strerror(n));
+				failed_device = device;
+				close_device();
+				return -1;
+			}
+			continue;
+		}
+		samples += n;
+		count -= n;
+	}
+	return 0;
+}
+
+/* Play samples, blocking until ALSA has accepted all of them. */
+static int play(const short *samples, int count)
+{
+	struct timespec start, end;
+	int piece, n;
+
+	if (pcm && pcm_rate != atomic_load(&audio_rate))
+		close_device();
+	// A preferred device may have shown up.
+	if (pcm && device > 0 && devices_changed(0))
+		close_device();
+	if (!pcm && open_device() < 0)
+		return -1;
+	if (!resampler)
+		return write_device(samples, count);
+	while (count > 0) {
+		piece = count < RESAMPLE_PIECE ? count : RESAMPLE_PIECE;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+		n = resampler_process(resampler, samples, piece, resample_buf);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+		resample_ns += (end.tv_sec - start.tv_sec) * 1000000000LL +
+		               end.tv_nsec - start.tv_nsec;
+		resampled += piece;
+		if (write_device(resample_buf, n) < 0)
+			return -1;
+		samples += piece;
+		count -= piece;
+	}
+	return 0;
+}
+
+/* Samples queued to ALSA but not played yet, at the synthesis rate */
+static long device_delay(void)
+{
+	snd_pcm_sframes_t delay;
+
+	if (!pcm || snd_pcm_delay(pcm, &delay) < 0 || delay < 0)
+		return 0;
+	if (!resampler)
+		return delay;
+	return (long) delay * pcm_rate / device_rate +
+	       resampler_delay(resampler);
+}
+
+/* Report the marks whose samples have been played.  Returns 1 if there
+ * are marks left to report later. */
+static int report_marks(void)
+{
+	uint64_t played = pcm_ring_read_pos(ring);
+	uint64_t pos;
+	long delay = device_delay();
+	int value;
+
+	played = (uint64_t) delay < played ? played - delay : 0;
+	while (pcm_ring_next_mark(ring, &pos, &value)) {
+		if (pos > played)
+			return 1;
+		// A flushed mark is not reported.
+		if (pcm_ring_pop_mark(ring))
+			softsynth_reportindex(value);
+	}
+	return 0;
+}
+
+static int have_work(int flushes)
+{
+	uint64_t pos;
+	int value;
+
+	// Pairs with the fence in wake_player.
+	atomic_thread_fence(memory_order_seq_cst);
+	return !should_run || atomic_load(&flush_count) != flushes ||
+	       pcm_ring_fill(ring) > 0 || pcm_ring_next_mark(ring, &pos, &value) ||
+	       (pcm && atomic_load(&close_requested)) ||
+	       atomic_load(&close_now);
+}
+
+void *audio_thread(void *arg)
+{
+	int flushes = atomic_load(&flush_count);
+	const short *samples;
+	int marks_left = 0;
+	int period;
+	int n;
+
+	prefault_stack();
+	setup_devices();
+	while (should_run) {
+		if (!marks_left) {
+			pthread_mutex_lock(&audio_guard);
+			atomic_store(&player_waiting, 1);
+			while (!have_work(flushes))
+				pthread_cond_wait(&audio_wake, &audio_guard);
+			atomic_store(&player_waiting, 0);
+			pthread_mutex_unlock(&audio_guard);
+		}
+
+		if (flushes != atomic_load(&flush_count)) {
+			long long requested;
+			flushes = atomic_load(&flush_count);
+			if (pcm) {
+				snd_pcm_drop(pcm);
+				snd_pcm_prepare(pcm);
+			}
+			if (resampler)
+				resampler_reset(resampler);
+			requested = atomic_exchange(&stop_time, 0);
+			if (requested) {
+				long long ns = monotonic_ns() - requested;
+				duration_add(&cancel_stats, ns);
+				stats_add(STATS_PLAYBACK, STAT_SILENCED, 1);
+				stats_add(STATS_PLAYBACK, STAT_SILENCE_NS, ns);
+				stats_max(STATS_PLAYBACK, STAT_SILENCE_MAX_NS, ns);
+			}
+		}
+		if (atomic_load(&close_now)) {
+			close_device();
+			atomic_store(&close_requested, 0);
+			atomic_store(&close_now, 0);
+			wake_producer();
+		}
+
+		period = atomic_load(&audio_rate) * audioPeriod / 1000;
+		n = pcm_ring_peek(ring, &samples);
+		if (n > period)
+			n = period;
+		if (n > 0) {
+			if (play(samples, n) < 0) {
+				/* Keep the samples.  Fail over to another device right
+				 * away, then wait for devices to show up, or synthesis
+				 * to give up on the audio output if this lasts. */
+				if (pcm_failing)
+					devices_changed(audioRetryMs);
+				else
+					failed_since = monotonic_ns();
+				pcm_failing = 1;
+				if (atomic_load(&no_device))
+					engine_waiting();
+				continue;
+			}
+			pcm_failing = 0;
+			failed_device = -1;
+			if (failed_since) {
+				long long ns = monotonic_ns() - failed_since;
+				failed_since = 0;
+				duration_add(&failover_stats, ns);
+				stats_add(STATS_PLAYBACK, STAT_FAILOVERS, 1);
+				stats_add(STATS_PLAYBACK, STAT_FAILOVER_NS, ns);
+				stats_max(STATS_PLAYBACK, STAT_FAILOVER_MAX_NS, ns);
+			}
+			if (atomic_load_explicit(&wakeup_time, memory_order_relaxed)) {
+				long long ns = monotonic_ns() - atomic_exchange(&wakeup_time,
+				                                                0);
+				duration_add(&wakeup_stats, ns);
+				stats_add(STATS_PLAYBACK, STAT_WAKEUPS, 1);
+				stats_add(STATS_PLAYBACK, STAT_WAKEUP_NS, ns);
+				stats_max(STATS_PLAYBACK, STAT_WAKEUP_MAX_NS, ns);
+			}
+			/* If the samples were flushed while being played, this
+			 * fails, and ALSA gets dropped on the next round. */
+			pcm_ring_consume(ring, n);
+			stats_add(STATS_PLAYBACK, STAT_SAMPLES_PLAYED, n);
+			stats_claim_thread(STATS_PLAYBACK);
+			watchdog_progress();
+			engine_progress();
+			wake_producer();
+			espeak_output_progressed();
+		}
+
+		marks_left = report_marks();
+		if (n == 0 && marks_left)
+			// Wait for the device to play up to the next mark.
+			short_sleep(audioPollNs);
+		if (n == 0 && !marks_left && atomic_load(&close_requested) &&
+		    pcm_ring_fill(ring) == 0) {
+			close_device();
+			atomic_store(&close_requested, 0);
+		}
+	}
+	close_device();
+	if (debug) {
+		if (resampled)
+			printf("Resampling: %.1f ms of CPU for %.1f s of audio "
+			       "(%.3f%%)\n", resample_ns / 1e6,
+			       (double) resampled / pcm_rate,
+			       resample_ns / 1e7 / ((double) resampled / pcm_rate));
+		print_duration_stats("Cancel to silence", &cancel_stats);
+		print_duration_stats("Wake-up to audio", &wakeup_stats);
+		print_duration_stats("Device failover", &failover_stats);
+		print_thread_stats("Playback");
+	}
+	return NULL;
+}
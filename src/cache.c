@@ -0,0 +1,232 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * A bounded LRU cache of synthesized audio.  The console keeps repeating
+ * itself (prompts, status lines, menu items), so recently spoken
+ * utterances are kept here and replayed instead of being synthesized
+ * again.  Keys are opaque byte strings built by the caller from the text
+ * and every parameter which affects the audio.
+ *
+ * Like the queue, this knows nothing about mutexes: it is meant to be
+ * used by a single thread.  Pointers returned by pcm_cache_lookup are
+ * only valid until the next call which modifies the cache.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "stringhandling.h"
+
+#define CACHE_BUCKETS 1024
+
+struct pcm_cache_entry_t {
+	uint64_t hash;
+	char *key;
+	size_t key_len;
+	short *samples;
+	int nsamples;
+	struct pcm_mark_t *marks;
+	int nmarks;
+	size_t bytes;
+	struct pcm_cache_entry_t *prev;      // LRU list, most recent first
+	struct pcm_cache_entry_t *next;
+	struct pcm_cache_entry_t *chain;     // hash bucket
+};
+
+struct pcm_cache_t {
+	size_t max_bytes;
+	size_t max_entry_bytes;
+	struct pcm_cache_entry_t *buckets[CACHE_BUCKETS];
+	struct pcm_cache_entry_t *head;
+	struct pcm_cache_entry_t *tail;
+	struct pcm_cache_stats_t stats;
+};
+
+/* FNV-1a */
+static uint64_t hash_key(const char *key, size_t key_len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < key_len; i++) {
+		h ^= (unsigned char) key[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+struct pcm_cache_t *new_pcm_cache(size_t max_bytes, size_t max_entry_bytes)
+{
+	struct pcm_cache_t *c = allocMem(sizeof(struct pcm_cache_t));
+
+	memset(c, 0, sizeof(struct pcm_cache_t));
+	c->max_bytes = max_bytes;
+	c->max_entry_bytes = max_entry_bytes;
+	if (c->max_entry_bytes > c->max_bytes)
+		c->max_entry_bytes = c->max_bytes;
+	return c;
+}
+
+void free_pcm_cache(struct pcm_cache_t *c)
+{
+	pcm_cache_clear(c);
+	free(c);
+}
+
+static void lru_unlink(struct pcm_cache_t *c, struct pcm_cache_entry_t *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		c->head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		c->tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static void lru_push_front(struct pcm_cache_t *c, struct pcm_cache_entry_t *e)
+{
+	e->prev = NULL;
+	e->next = c->head;
+	if (c->head)
+		c->head->prev = e;
+	c->head = e;
+	if (!c->tail)
+		c->tail = e;
+}
+
+static void remove_entry(struct pcm_cache_t *c, struct pcm_cache_entry_t *e)
+{
+	struct pcm_cache_entry_t **pp = &c->buckets[e->hash % CACHE_BUCKETS];
+
+	while (*pp != e)
+		pp = &(*pp)->chain;
+	*pp = e->chain;
+	lru_unlink(c, e);
+	c->stats.entries--;
+	c->stats.bytes -= e->bytes;
+	free(e->key);
+	free(e->samples);
+	free(e->marks);
+	free(e);
+}
+
+static struct pcm_cache_entry_t *find_entry(struct pcm_cache_t *c,
+                                            uint64_t hash, const char *key,
+                                            size_t key_len)
+{
+	struct pcm_cache_entry_t *e;
+
+	for (e = c->buckets[hash % CACHE_BUCKETS]; e; e = e->chain)
+		if (e->hash == hash && e->key_len == key_len &&
+		    !memcmp(e->key, key, key_len))
+			return e;
+	return NULL;
+}
+
+int pcm_cache_lookup(struct pcm_cache_t *c, const char *key, size_t key_len,
+                     const short **samples, int *nsamples,
+                     const struct pcm_mark_t **marks, int *nmarks)
+{
+	struct pcm_cache_entry_t *e;
+
+	e = find_entry(c, hash_key(key, key_len), key, key_len);
+	if (!e) {
+		c->stats.misses++;
+		return 0;
+	}
+	c->stats.hits++;
+	lru_unlink(c, e);
+	lru_push_front(c, e);
+	*samples = e->samples;
+	*nsamples = e->nsamples;
+	*marks = e->marks;
+	*nmarks = e->nmarks;
+	return 1;
+}
+
+/* Like pcm_cache_lookup, but without counting a hit or a miss, nor
+ * making the entry the most recently used. */
+int pcm_cache_contains(struct pcm_cache_t *c, const char *key, size_t key_len)
+{
+	return find_entry(c, hash_key(key, key_len), key, key_len) != NULL;
+}
+
+void pcm_cache_insert(struct pcm_cache_t *c, const char *key, size_t key_len,
+                      const short *samples, int nsamples,
+                      const struct pcm_mark_t *marks, int nmarks)
+{
+	struct pcm_cache_entry_t *e;
+	uint64_t hash = hash_key(key, key_len);
+	size_t bytes;
+
+	bytes = sizeof(struct pcm_cache_entry_t) + key_len +
+	        nsamples * sizeof(short) + nmarks * sizeof(struct pcm_mark_t);
+	if (nsamples <= 0 || bytes > c->max_entry_bytes)
+		return;
+
+	e = find_entry(c, hash, key, key_len);
+	if (e)
+		remove_entry(c, e);
+	while (c->tail && c->stats.bytes + bytes > c->max_bytes) {
+		remove_entry(c, c->tail);
+		c->stats.evictions++;
+	}
+
+	e = allocMem(sizeof(struct pcm_cache_entry_t));
+	e->hash = hash;
+	e->key = allocMem(key_len);
+	memcpy(e->key, key, key_len);
+	e->key_len = key_len;
+	e->samples = allocMem(nsamples * sizeof(short));
+	memcpy(e->samples, samples, nsamples * sizeof(short));
+	e->nsamples = nsamples;
+	e->marks = NULL;
+	if (nmarks) {
+		e->marks = allocMem(nmarks * sizeof(struct pcm_mark_t));
+		memcpy(e->marks, marks, nmarks * sizeof(struct pcm_mark_t));
+	}
+	e->nmarks = nmarks;
+	e->bytes = bytes;
+	e->chain = c->buckets[hash % CACHE_BUCKETS];
+	c->buckets[hash % CACHE_BUCKETS] = e;
+	lru_push_front(c, e);
+	c->stats.entries++;
+	c->stats.bytes += bytes;
+	c->stats.insertions++;
+}
+
+void pcm_cache_clear(struct pcm_cache_t *c)
+{
+	while (c->head)
+		remove_entry(c, c->head);
+}
+
+size_t pcm_cache_max_entry_bytes(struct pcm_cache_t *c)
+{
+	return c->max_entry_bytes;
+}
+
+void pcm_cache_get_stats(struct pcm_cache_t *c, struct pcm_cache_stats_t *stats)
+{
+	*stats = c->stats;
+}
@@ -0,0 +1,60 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stddef.h>
+
+/* An index mark within synthesized audio. */
+struct pcm_mark_t {
+	int offset;     // in samples from the start of the utterance
+	int value;
+};
+
+struct pcm_cache_stats_t {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long insertions;
+	unsigned long evictions;
+	size_t entries;
+	size_t bytes;
+};
+
+struct pcm_cache_t;     // An opaque type.
+
+extern struct pcm_cache_t *new_pcm_cache(size_t max_bytes,
+                                         size_t max_entry_bytes);
+extern void free_pcm_cache(struct pcm_cache_t *c);
+extern int pcm_cache_lookup(struct pcm_cache_t *c, const char *key,
+                            size_t key_len, const short **samples,
+                            int *nsamples, const struct pcm_mark_t **marks,
+                            int *nmarks);
+extern int pcm_cache_contains(struct pcm_cache_t *c, const char *key,
+                              size_t key_len);
+extern void pcm_cache_insert(struct pcm_cache_t *c, const char *key,
+                             size_t key_len, const short *samples,
+                             int nsamples, const struct pcm_mark_t *marks,
+                             int nmarks);
+extern void pcm_cache_clear(struct pcm_cache_t *c);
+extern size_t pcm_cache_max_entry_bytes(struct pcm_cache_t *c);
+extern void pcm_cache_get_stats(struct pcm_cache_t *c,
+                                struct pcm_cache_stats_t *stats);
+
+#endif
@@ -17,12 +17,20 @@
  *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "engine.h"
 #include "espeakup.h"
+#include "pool.h"
+#include "realtime.h"
+#include "repeat.h"
+#include "stats.h"
 #include "stringhandling.h"
 #include "version.h"
 
@@ -32,15 +40,179 @@ extern char *pidPath;
 /* default voice */
 extern char *defaultVoice;
 
+/* default voice parameters, and how they map to the espeak ones */
+extern int defaultFrequency;
+extern int defaultPitch;
+extern int defaultRange;
+extern int defaultRate;
+extern int defaultVolume;
+extern int frequencyMultiplier;
+extern int pitchMultiplier;
+extern int rangeMultiplier;
+extern int rateMultiplier;
+extern int rateOffset;
+extern int volumeMultiplier;
+
 /* Whether to drive ALSA volume */
 extern int alsaVolume;
 
+/* PCM cache sizes */
+extern int cacheSize;
+extern int cacheEntrySize;
+
+/* Number of synthesis worker processes */
+extern int synthWorkers;
+
+/* Audio buffering and latency, in milliseconds */
+extern int bufferLength;
+extern int audioLatency;
+extern int audioPeriod;
+extern int audioAhead;
+extern int audioResample;
+
+/* Silence trimming */
+extern int trimThreshold;
+extern int trimMaxPause;
+extern int trimTextLength;
+
+/* Collapsing of runs of symbols */
+extern int collapseRuns;
+
+/* Time compression beyond the top rate */
+extern double rateBoost;
+
+/* Idle policy */
+extern int idleTimeout;
+extern int idleSuspend;
+
+/* Audio output */
+extern char *audioDevices;
+
+/* Coalescing bursts of flushes */
+extern int flushDebounce;
+
+/* Wedge detection and recovery */
+extern int stopAckTimeout;
+extern int maxRestarts;
+extern int healthyTime;
+
+/* Offline rendering */
+extern char *renderInput;
+extern char *renderOutput;
+
+/* Substitution dictionary */
+extern char *substitutionsPath;
+
+/* Configuration file, read before the command line is applied.  When
+ * given on the command line, it must exist. */
+static char *configPath = "/etc/espeakup.conf";
+static int configRequired = 0;
+#define CONFIG_MAX_OPTIONS 256
+
+/* long options without a short equivalent */
+enum
+{
+	OPT_CACHE_SIZE = 256,
+	OPT_CACHE_ENTRY_SIZE,
+	OPT_WORKERS,
+	OPT_REALTIME,
+	OPT_REALTIME_POLICY,
+	OPT_CPU_AFFINITY,
+	OPT_BUFFER_LENGTH,
+	OPT_AUDIO_LATENCY,
+	OPT_AUDIO_PERIOD,
+	OPT_AUDIO_AHEAD,
+	OPT_TRIM_SILENCE,
+	OPT_MAX_PAUSE,
+	OPT_TRIM_LENGTH,
+	OPT_RATE_BOOST,
+	OPT_RESAMPLE,
+	OPT_STATS_SOCKET,
+	OPT_STATS_FILE,
+	OPT_STATS_INTERVAL,
+	OPT_STOP_TIMEOUT,
+	OPT_STALL_TIMEOUT,
+	OPT_MAX_RESTARTS,
+	OPT_HEALTHY_TIME,
+	OPT_CONFIG,
+	OPT_DEFAULT_FREQUENCY,
+	OPT_DEFAULT_PITCH,
+	OPT_DEFAULT_RANGE,
+	OPT_DEFAULT_RATE,
+	OPT_DEFAULT_VOLUME,
+	OPT_FREQUENCY_MULTIPLIER,
+	OPT_PITCH_MULTIPLIER,
+	OPT_RANGE_MULTIPLIER,
+	OPT_RATE_MULTIPLIER,
+	OPT_RATE_OFFSET,
+	OPT_VOLUME_MULTIPLIER,
+	OPT_SUBSTITUTIONS,
+	OPT_COLLAPSE_RUNS,
+	OPT_RENDER,
+	OPT_IDLE_TIMEOUT,
+	OPT_FLUSH_DEBOUNCE,
+	OPT_DEVICE,
+	OPT_STANDBY,
+	OPT_REPEAT_WINDOW,
+	OPT_REPEAT_LENGTH,
+	OPT_REPEAT_MODE,
+	OPT_ENGINE,
+};
+
 /* command line options */
 const char *shortOptions = "P:V:adhv";
 const struct option longOptions[] = {
 	{"pid-path", required_argument, NULL, 'P'},
 	{"default-voice", required_argument, NULL, 'V'},
 	{"alsa-volume", no_argument, &alsaVolume, 1},
+	{"cache-size", required_argument, NULL, OPT_CACHE_SIZE},
+	{"cache-entry-size", required_argument, NULL, OPT_CACHE_ENTRY_SIZE},
+	{"workers", required_argument, NULL, OPT_WORKERS},
+	{"realtime", optional_argument, NULL, OPT_REALTIME},
+	{"realtime-policy", required_argument, NULL, OPT_REALTIME_POLICY},
+	{"cpu-affinity", required_argument, NULL, OPT_CPU_AFFINITY},
+	{"buffer-length", required_argument, NULL, OPT_BUFFER_LENGTH},
+	{"audio-latency", required_argument, NULL, OPT_AUDIO_LATENCY},
+	{"audio-period", required_argument, NULL, OPT_AUDIO_PERIOD},
+	{"audio-ahead", required_argument, NULL, OPT_AUDIO_AHEAD},
+	{"trim-silence", optional_argument, NULL, OPT_TRIM_SILENCE},
+	{"max-pause", required_argument, NULL, OPT_MAX_PAUSE},
+	{"trim-length", required_argument, NULL, OPT_TRIM_LENGTH},
+	{"rate-boost", required_argument, NULL, OPT_RATE_BOOST},
+	{"resample", optional_argument, NULL, OPT_RESAMPLE},
+	{"stats-socket", required_argument, NULL, OPT_STATS_SOCKET},
+	{"stats-file", required_argument, NULL, OPT_STATS_FILE},
+	{"stats-interval", required_argument, NULL, OPT_STATS_INTERVAL},
+	{"stop-timeout", required_argument, NULL, OPT_STOP_TIMEOUT},
+	{"stall-timeout", required_argument, NULL, OPT_STALL_TIMEOUT},
+	{"max-restarts", required_argument, NULL, OPT_MAX_RESTARTS},
+	{"healthy-time", required_argument, NULL, OPT_HEALTHY_TIME},
+	{"standby", optional_argument, NULL, OPT_STANDBY},
+	{"idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT},
+	{"idle-suspend", no_argument, &idleSuspend, 1},
+	{"flush-debounce", optional_argument, NULL, OPT_FLUSH_DEBOUNCE},
+	{"device", required_argument, NULL, OPT_DEVICE},
+	{"config", required_argument, NULL, OPT_CONFIG},
+	{"default-frequency", required_argument, NULL, OPT_DEFAULT_FREQUENCY},
+	{"default-pitch", required_argument, NULL, OPT_DEFAULT_PITCH},
+	{"default-range", required_argument, NULL, OPT_DEFAULT_RANGE},
+	{"default-rate", required_argument, NULL, OPT_DEFAULT_RATE},
+	{"default-volume", required_argument, NULL, OPT_DEFAULT_VOLUME},
+	{"frequency-multiplier", required_argument, NULL,
+	 OPT_FREQUENCY_MULTIPLIER},
+	{"pitch-multiplier", required_argument, NULL, OPT_PITCH_MULTIPLIER},
+	{"range-multiplier", required_argument, NULL, OPT_RANGE_MULTIPLIER},
+	{"rate-multiplier", required_argument, NULL, OPT_RATE_MULTIPLIER},
+	{"rate-offset", required_argument, NULL, OPT_RATE_OFFSET},
+	{"volume-multiplier", required_argument, NULL, OPT_VOLUME_MULTIPLIER},
+	{"substitutions", required_argument, NULL, OPT_SUBSTITUTIONS},
+	{"collapse-runs", optional_argument, NULL, OPT_COLLAPSE_RUNS},
+	{"repeat-window", optional_argument, NULL, OPT_REPEAT_WINDOW},
+	{"repeat-length", required_argument, NULL, OPT_REPEAT_LENGTH},
+	{"repeat-mode", required_argument, NULL, OPT_REPEAT_MODE},
+	{"render", no_argument, NULL, OPT_RENDER},
+	// Internal: an engine process, started by the supervisor.
+	{"engine", required_argument, NULL, OPT_ENGINE},
 	{"acsint", no_argument, NULL, 'a'},
 	{"debug", no_argument, NULL, 'd'},
 	{"help", no_argument, NULL, 'h'},
@@ -49,11 +221,86 @@ const struct option longOptions[] = {
 
 static void show_help()
 {
-	printf("Usage: espeakup [options]\n\n");
+	printf("Usage: espeakup [options]\n");
+	printf("       espeakup [options] --render [input [output.wav]]\n\n");
 	printf("Options are as follows:\n");
+	printf("  --config=path\t\t\t\tRead options from this file.\n");
 	printf("  --pid-path=path, -P path\t\tSet path for pid file.\n");
 	printf("  --default-voice=voice, -V voice\tSet default voice.\n");
+	printf("  --default-frequency=value\t\tDefault frequency, from 0 to "
+	       "9.\n");
+	printf("  --default-pitch=value\t\t\tDefault pitch, from 0 to 9.\n");
+	printf("  --default-range=value\t\t\tDefault range, from 0 to 9.\n");
+	printf("  --default-rate=value\t\t\tDefault rate, from 0 to 9.\n");
+	printf("  --default-volume=value\t\tDefault volume, from 0 to 9.\n");
+	printf("  --frequency-multiplier=value\t\tScale of the frequency for "
+	       "espeak-ng.\n");
+	printf("  --pitch-multiplier=value\t\tScale of the pitch for "
+	       "espeak-ng.\n");
+	printf("  --range-multiplier=value\t\tScale of the range for "
+	       "espeak-ng.\n");
+	printf("  --rate-multiplier=value\t\tScale of the rate for espeak-ng.\n");
+	printf("  --rate-offset=value\t\t\tOffset of the rate for espeak-ng.\n");
+	printf("  --volume-multiplier=value\t\tScale of the volume for "
+	       "espeak-ng.\n");
+	printf("  --substitutions=path\t\t\tReplace text as listed in this "
+	       "file.\n");
+	printf("  --collapse-runs[=length]\t\tCollapse longer runs of a "
+	       "symbol.\n");
+	printf("  --repeat-window[=ms]\t\t\tSuppress texts repeated within "
+	       "that long.\n");
+	printf("  --repeat-length=chars\t\t\tShortest text suppressed.\n");
+	printf("  --repeat-mode=drop|shorten\t\tDrop repeats, or speak their "
+	       "first word.\n");
 	printf("  --alsa-volume\t\t\t\tDrive the ALSA volume.\n");
+	printf("  --cache-size=KiB\t\t\tSize of the audio cache (0 disables "
+	       "it).\n");
+	printf("  --cache-entry-size=KiB\t\tMaximum size of a cached "
+	       "utterance.\n");
+	printf("  --workers=count\t\t\tSynthesize ahead in count worker "
+	       "processes.\n");
+	printf("  --realtime[=priority]\t\t\tPlay audio with real-time "
+	       "priority.\n");
+	printf("  --realtime-policy=fifo|rr\t\tReal-time scheduling policy.\n");
+	printf("  --cpu-affinity=list\t\t\tRun on these CPUs only.\n");
+	printf("  --buffer-length=ms\t\t\tLength of the espeak audio "
+	       "buffers.\n");
+	printf("  --device=name[,name...]\t\tALSA devices to play on, by "
+	       "preference.\n");
+	printf("  --audio-latency=ms\t\t\tLatency requested from ALSA.\n");
+	printf("  --audio-period=ms\t\t\tSize of the writes to ALSA.\n");
+	printf("  --audio-ahead=ms\t\t\tHow far synthesis may get ahead of "
+	       "playback.\n");
+	printf("  --resample[=rate]\t\t\tPlay at the native rate of the "
+	       "device.\n");
+	printf("  --trim-silence[=amplitude]\t\tTrim the silence around short "
+	       "texts.\n");
+	printf("  --max-pause=ms\t\t\tLongest pause kept when trimming.\n");
+	printf("  --trim-length=chars\t\t\tLongest text trimmed.\n");
+	printf("  --rate-boost=factor\t\t\tSpeed up the top rates by up to "
+	       "factor.\n");
+	printf("  --stats-socket=path\t\t\tServe live statistics on a UNIX "
+	       "socket.\n");
+	printf("  --stats-file=path\t\t\tWrite live statistics to a file.\n");
+	printf("  --stats-interval=seconds\t\tHow often to write the statistics "
+	       "file.\n");
+	printf("  --stop-timeout=ms\t\t\tExit when speech cannot be stopped "
+	       "for that long.\n");
+	printf("  --stall-timeout=ms\t\t\tRestart espeak when stuck for that "
+	       "long.\n");
+	printf("  --max-restarts=count\t\t\tExit after count restarts in a "
+	       "row.\n");
+	printf("  --healthy-time=seconds\t\tForget about restarts after that "
+	       "long.\n");
+	printf("  --standby[=ms]\t\t\tSwitch to a standby engine process "
+	       "when stuck.\n");
+	printf("  --render\t\t\t\tRender input (default stdin) into a WAV "
+	       "file\n\t\t\t\t\t(default stdout), and exit.\n");
+	printf("  --idle-timeout=seconds\t\tRelease the audio device when "
+	       "idle that long.\n");
+	printf("  --idle-suspend\t\t\tAlso shut espeak-ng down when idle.\n");
+	printf("  --flush-debounce[=ms]\t\t\tOnly speak the last text of a burst "
+	       "of flushes.\n");
 	printf("  --debug, -d\t\t\t\tDebug mode (stay in the foreground).\n");
 	printf("  --help, -h\t\t\t\tShow this help.\n");
 	printf("  --version, -v\t\t\t\tDisplay the software version.\n");
@@ -70,17 +317,97 @@ static void show_version(void)
 	exit(0);
 }
 
-void process_cli(int argc, char **argv)
+/* Where options come from: the command line, or the configuration file
+ * when given its path.  While reloading, invalid options are reported but
+ * do not make us exit, and the options which only apply at startup are
+ * ignored. */
+static const char *optionSource = NULL;
+static int reloading = 0;
+static int saved_argc;
+static char **saved_argv;
+
+static void invalid_option(const char *name, const char *arg)
+{
+	if (optionSource)
+		fprintf(stderr, "%s: ", optionSource);
+	fprintf(stderr, "Invalid value for --%s: %s\n", name, arg);
+	if (!reloading)
+		exit(1);
+}
+
+static void double_option(const char *name, const char *arg, double min,
+                          double max, double *val)
+{
+	char *end;
+	double v;
+
+	v = strtod(arg, &end);
+	if (!*arg || *end || !(v >= min && v <= max)) {
+		invalid_option(name, arg);
+		return;
+	}
+	*val = v;
+}
+
+static void int_option(const char *name, const char *arg, int min, int max,
+                       int *val)
+{
+	char *end;
+	long v;
+
+	v = strtol(arg, &end, 10);
+	if (!*arg || *end || v < min || v > max) {
+		invalid_option(name, arg);
+		return;
+	}
+	*val = v;
+}
+
+/* Options which cannot change once running */
+static int startup_only(int opt)
+{
+	switch (opt) {
+	case 'P':
+	case 'a':
+	case 'd':
+	case 'h':
+	case 'v':
+	case OPT_CONFIG:
+	case OPT_WORKERS:
+	case OPT_REALTIME:
+	case OPT_REALTIME_POLICY:
+	case OPT_CPU_AFFINITY:
+	case OPT_AUDIO_AHEAD:
+	case OPT_RATE_BOOST:
+	case OPT_STATS_SOCKET:
+	case OPT_STATS_FILE:
+	case OPT_STATS_INTERVAL:
+	case OPT_SUBSTITUTIONS:
+	case OPT_RENDER:
+	case OPT_DEVICE:
+	case OPT_STANDBY:
+	case OPT_ENGINE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void parse_options(int argc, char **argv)
 {
 	int opt;
 
+	optind = 0;         // Start over, also resetting the GNU extensions.
 	do {
 		opt = getopt_long(argc, argv, shortOptions, longOptions, NULL);
+		if (reloading && startup_only(opt))
+			continue;
 		switch (opt) {
 		case 'P':
 			pidPath = dupeString(optarg);
 			break;
 		case 'V':
+			free(defaultVoice);
 			defaultVoice = dupeString(optarg);
 			break;
 		case 'a':
@@ -95,12 +422,327 @@ void process_cli(int argc, char **argv)
 		case 'v':
 			show_version();
 			break;
+		case OPT_CONFIG:
+			configPath = dupeString(optarg);
+			configRequired = 1;
+			break;
+		case OPT_DEFAULT_FREQUENCY:
+			int_option("default-frequency", optarg, 0, 9, &defaultFrequency);
+			break;
+		case OPT_DEFAULT_PITCH:
+			int_option("default-pitch", optarg, 0, 9, &defaultPitch);
+			break;
+		case OPT_DEFAULT_RANGE:
+			int_option("default-range", optarg, 0, 9, &defaultRange);
+			break;
+		case OPT_DEFAULT_RATE:
+			int_option("default-rate", optarg, 0, 9, &defaultRate);
+			break;
+		case OPT_DEFAULT_VOLUME:
+			int_option("default-volume", optarg, 0, 9, &defaultVolume);
+			break;
+		case OPT_FREQUENCY_MULTIPLIER:
+			int_option("frequency-multiplier", optarg, 0, 100,
+			           &frequencyMultiplier);
+			break;
+		case OPT_PITCH_MULTIPLIER:
+			int_option("pitch-multiplier", optarg, 0, 100, &pitchMultiplier);
+			break;
+		case OPT_RANGE_MULTIPLIER:
+			int_option("range-multiplier", optarg, 0, 100, &rangeMultiplier);
+			break;
+		case OPT_RATE_MULTIPLIER:
+			int_option("rate-multiplier", optarg, 0, 200, &rateMultiplier);
+			break;
+		case OPT_RATE_OFFSET:
+			int_option("rate-offset", optarg, 0, 1000, &rateOffset);
+			break;
+		case OPT_VOLUME_MULTIPLIER:
+			int_option("volume-multiplier", optarg, 0, 100,
+			           &volumeMultiplier);
+			break;
+		case OPT_CACHE_SIZE:
+			int_option("cache-size", optarg, 0, 1024 * 1024, &cacheSize);
+			break;
+		case OPT_CACHE_ENTRY_SIZE:
+			int_option("cache-entry-size", optarg, 1, 1024 * 1024,
+			           &cacheEntrySize);
+			break;
+		case OPT_WORKERS:
+			int_option("workers", optarg, 0, POOL_MAX_WORKERS, &synthWorkers);
+			break;
+		case OPT_REALTIME:
+			if (optarg)
+				int_option("realtime", optarg, 1, 99, &realtimePriority);
+			else
+				realtimePriority = 20;
+			break;
+		case OPT_REALTIME_POLICY:
+			if (!strcmp(optarg, "fifo"))
+				realtimePolicy = SCHED_FIFO;
+			else if (!strcmp(optarg, "rr"))
+				realtimePolicy = SCHED_RR;
+			else
+				invalid_option("realtime-policy", optarg);
+			break;
+		case OPT_CPU_AFFINITY:
+			if (valid_cpu_list(optarg))
+				cpuAffinity = dupeString(optarg);
+			else
+				invalid_option("cpu-affinity", optarg);
+			break;
+		case OPT_BUFFER_LENGTH:
+			int_option("buffer-length", optarg, 0, 1000, &bufferLength);
+			break;
+		case OPT_AUDIO_LATENCY:
+			int_option("audio-latency", optarg, 1, 2000, &audioLatency);
+			break;
+		case OPT_AUDIO_PERIOD:
+			int_option("audio-period", optarg, 1, 1000, &audioPeriod);
+			break;
+		case OPT_AUDIO_AHEAD:
+			int_option("audio-ahead", optarg, 50, 60000, &audioAhead);
+			break;
+		case OPT_RESAMPLE:
+			if (optarg)
+				int_option("resample", optarg, 8000, 384000, &audioResample);
+			else
+				audioResample = 48000;
+			break;
+		case OPT_TRIM_SILENCE:
+			if (optarg)
+				int_option("trim-silence", optarg, 1, 32767, &trimThreshold);
+			else
+				trimThreshold = 300;
+			break;
+		case OPT_MAX_PAUSE:
+			int_option("max-pause", optarg, 0, 10000, &trimMaxPause);
+			break;
+		case OPT_TRIM_LENGTH:
+			int_option("trim-length", optarg, 1, 1000000, &trimTextLength);
+			break;
+		case OPT_RATE_BOOST:
+			double_option("rate-boost", optarg, 1.0, 4.0, &rateBoost);
+			break;
+		case OPT_STATS_SOCKET:
+			statsSocket = dupeString(optarg);
+			break;
+		case OPT_STATS_FILE:
+			statsFile = dupeString(optarg);
+			break;
+		case OPT_STATS_INTERVAL:
+			int_option("stats-interval", optarg, 1, 86400, &statsInterval);
+			break;
+		case OPT_SUBSTITUTIONS:
+			substitutionsPath = dupeString(optarg);
+			break;
+		case OPT_RENDER:
+			renderMode = 1;
+			break;
+		case OPT_COLLAPSE_RUNS:
+			if (optarg)
+				int_option("collapse-runs", optarg, 0, 1000, &collapseRuns);
+			else
+				collapseRuns = 4;
+			break;
+		case OPT_REPEAT_WINDOW:
+			if (optarg)
+				int_option("repeat-window", optarg, 0, 600000,
+				           &repeatWindow);
+			else
+				repeatWindow = 2000;
+			break;
+		case OPT_REPEAT_LENGTH:
+			int_option("repeat-length", optarg, 1, 1000000, &repeatLength);
+			break;
+		case OPT_REPEAT_MODE:
+			if (!strcmp(optarg, "drop"))
+				repeatMode = REPEAT_DROP;
+			else if (!strcmp(optarg, "shorten"))
+				repeatMode = REPEAT_SHORTEN;
+			else
+				invalid_option("repeat-mode", optarg);
+			break;
+		case OPT_STOP_TIMEOUT:
+			int_option("stop-timeout", optarg, 100, 600000, &stopAckTimeout);
+			break;
+		case OPT_STALL_TIMEOUT:
+			int_option("stall-timeout", optarg, 100, 600000, &stallTimeout);
+			break;
+		case OPT_MAX_RESTARTS:
+			int_option("max-restarts", optarg, 0, 1000, &maxRestarts);
+			break;
+		case OPT_HEALTHY_TIME:
+			int_option("healthy-time", optarg, 1, 86400, &healthyTime);
+			break;
+		case OPT_STANDBY:
+			if (optarg)
+				int_option("standby", optarg, 100, 600000, &standbyTimeout);
+			else
+				standbyTimeout = 1000;
+			break;
+		case OPT_ENGINE:
+			if (engine_init(optarg) < 0)
+				invalid_option("engine", optarg);
+			break;
+		case OPT_IDLE_TIMEOUT:
+			int_option("idle-timeout", optarg, 0, 86400 * 7, &idleTimeout);
+			break;
+		case OPT_FLUSH_DEBOUNCE:
+			if (optarg)
+				int_option("flush-debounce", optarg, 0, 1000,
+				           &flushDebounce);
+			else
+				flushDebounce = 50;
+			break;
+		case OPT_DEVICE:
+			audioDevices = dupeString(optarg);
+			break;
 		case -1:
 		case 0:
 			break;
 		default:
+			// getopt_long has reported the error.
+			if (reloading)
+				break;
+			if (optionSource)
+				exit(1);
 			show_help();
 			break;
 		}
 	} while (opt != -1);
 }
+
+/* Read the options from the configuration file: one per line, as in
+ * "cache-size = 4096", the name of the long option without the leading
+ * dashes, and its value if it takes one.  Blank lines and lines starting
+ * with # are ignored. */
+static void read_config(void)
+{
+	FILE *f;
+	char line[1024];
+	char *args[CONFIG_MAX_OPTIONS + 1];
+	int nargs = 1;
+	int i;
+
+	f = fopen(configPath, "r");
+	if (!f) {
+		if (configRequired || errno != ENOENT) {
+			fprintf(stderr, "Unable to read %s: %s\n", configPath,
+			        strerror(errno));
+			if (!reloading)
+				exit(1);
+		}
+		return;
+	}
+
+	args[0] = configPath;       // for the error messages of getopt_long
+	while (fgets(line, sizeof(line), f) && nargs < CONFIG_MAX_OPTIONS) {
+		char *name = line;
+		char *value;
+		char *end;
+
+		while (isspace((unsigned char) *name))
+			name++;
+		end = name + strlen(name);
+		while (end > name && isspace((unsigned char) end[-1]))
+			*--end = 0;
+		if (!*name || *name == '#')
+			continue;
+
+		value = name + strcspn(name, "= \t");
+		if (*value) {
+			*value++ = 0;
+			value += strspn(value, "= \t");
+		}
+		if (*value)
+			args[nargs] = allocMem(strlen(name) + strlen(value) + 4);
+		else
+			args[nargs] = allocMem(strlen(name) + 3);
+		sprintf(args[nargs], *value ? "--%s=%s" : "--%s", name, value);
+		nargs++;
+	}
+	fclose(f);
+	args[nargs] = NULL;
+
+	optionSource = configPath;
+	parse_options(nargs, args);
+	optionSource = NULL;
+	for (i = 1; i < nargs; i++)
+		free(args[i]);
+}
+
+/* The options which can change while running, and their built-in values:
+ * an option removed from the configuration file goes back to its default
+ * on reload, as it would on a restart. */
+static int *const reloadable[] = {
+	&defaultFrequency, &defaultPitch, &defaultRange, &defaultRate,
+	&defaultVolume, &frequencyMultiplier, &pitchMultiplier,
+	&rangeMultiplier, &rateMultiplier, &rateOffset, &volumeMultiplier,
+	&alsaVolume, &cacheSize, &cacheEntrySize, &bufferLength, &audioLatency,
+	&audioPeriod, &audioResample, &trimThreshold, &trimMaxPause,
+	&trimTextLength, &collapseRuns, &idleTimeout, &idleSuspend,
+	&flushDebounce, &stopAckTimeout, &stallTimeout, &maxRestarts,
+	&healthyTime, &repeatWindow, &repeatLength, &repeatMode,
+};
+#define NRELOADABLE (int) (sizeof(reloadable) / sizeof(reloadable[0]))
+static int reloadableDefaults[NRELOADABLE];
+
+/* The command line overrides the configuration file, but also tells where
+ * it is: go through it once to find out, read the file, and go through
+ * the command line again. */
+void process_cli(int argc, char **argv)
+{
+	int i;
+
+	for (i = 0; i < NRELOADABLE; i++)
+		reloadableDefaults[i] = *reloadable[i];
+	saved_argc = argc;
+	saved_argv = argv;
+	parse_options(argc, argv);
+	read_config();
+	parse_options(argc, argv);
+
+	// What is left is for rendering.
+	if (renderMode && optind < argc)
+		renderInput = argv[optind++];
+	if (renderMode && optind < argc)
+		renderOutput = argv[optind++];
+	if (renderMode && optind < argc) {
+		fprintf(stderr, "Unexpected argument: %s\n", argv[optind]);
+		exit(1);
+	}
+}
+
+/* The command line espeakup was started with, with extra inserted after
+ * the program name, to start it again.  Returns NULL when out of
+ * memory. */
+char **restart_arguments(const char *extra)
+{
+	char **argv = calloc(saved_argc + 2, sizeof(char *));
+	int i;
+
+	if (!argv)
+		return NULL;
+	argv[0] = saved_argv[0];
+	argv[1] = (char *) extra;
+	for (i = 1; i < saved_argc; i++)
+		argv[i + 1] = saved_argv[i];
+	return argv;
+}
+
+/* Read the configuration file again, and apply the command line again on
+ * top of it.  Called from the espeak thread, which applies the changes. */
+void reload_options(void)
+{
+	int i;
+
+	for (i = 0; i < NRELOADABLE; i++)
+		*reloadable[i] = reloadableDefaults[i];
+	free(defaultVoice);
+	defaultVoice = NULL;
+	reloading = 1;
+	read_config();
+	parse_options(saved_argc, saved_argv);
+	reloading = 0;
+}
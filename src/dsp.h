@@ -0,0 +1,57 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DSP_H
+#define __DSP_H
+
+#include <math.h>
+
+/* Helpers shared by the signal processing stages. */
+
+#define DSP_LANES 8
+
+/* Dot product of two float vectors.  The independent partial sums let
+ * the compiler vectorize the loop without relaxing floating point
+ * semantics. */
+static inline float dot_product(const float *a, const float *b, int n)
+{
+	float sum[DSP_LANES] = {0};
+	float total = 0;
+	int i, j;
+
+	for (i = 0; i + DSP_LANES <= n; i += DSP_LANES)
+		for (j = 0; j < DSP_LANES; j++)
+			sum[j] += a[i + j] * b[i + j];
+	for (; i < n; i++)
+		total += a[i] * b[i];
+	for (j = 0; j < DSP_LANES; j++)
+		total += sum[j];
+	return total;
+}
+
+static inline short clip_sample(float v)
+{
+	if (v > 32767)
+		return 32767;
+	if (v < -32768)
+		return -32768;
+	return lrintf(v);
+}
+
+#endif
@@ -0,0 +1,938 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Engine processes under a supervisor.  With --standby, the process
+ * started keeps the softsynth device and parses what comes in, but hands
+ * the entries over to an engine process, espeakup proper, which
+ * synthesizes and plays them and reports the index marks back.  A
+ * standby engine is started in advance.  When the active engine dies, or
+ * has work and makes no progress for standbyTimeout milliseconds, it is
+ * killed and the standby one takes over at once, with the voice
+ * parameters and the entries which were not played yet, and a new
+ * standby engine is started.  This keeps a wedged espeak-ng or sound
+ * device from costing the queue and the voice parameters, and the
+ * seconds a restart of the whole daemon takes.
+ *
+ * The entries go over a socket to the engine, which reports back the
+ * index marks, the commands it has applied along with its voice
+ * parameters, and the texts once they have been played, through marks of
+ * its own in the audio ring.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "espeakup.h"
+#include "parser.h"
+#include "probes.h"
+#include "realtime.h"
+#include "repeat.h"
+#include "stats.h"
+#include "stringhandling.h"
+#include "watchdog.h"
+
+/* Longer texts are handed over in several pieces. */
+#define ENGINE_MAX_TEXT (4 * PARSER_MAX_INPUT)
+
+/* How long to wait before starting a standby engine again when it died,
+ * in nanoseconds */
+#define STANDBY_RESPAWN_NS 1000000000LL
+
+/* How long the active engine may have work without making progress, in
+ * milliseconds, or 0 to run without a supervisor. */
+int standbyTimeout = 0;
+
+extern int stopAckTimeout;
+extern int maxRestarts;
+extern int flushDebounce;
+extern char *defaultVoice;
+
+enum engine_msg_type_t
+{
+	/* supervisor to engine */
+	MSG_TEXT,
+	MSG_COMMAND,
+	MSG_FLUSH,
+	MSG_PARAMS,
+	/* engine to supervisor, MSG_PARAMS too */
+	MSG_MARK,
+	MSG_DONE,
+	MSG_PROGRESS,
+	MSG_WAITING,        // for a sound device to show up
+};
+
+struct engine_msg_t {
+	enum engine_msg_type_t type;
+	enum command_t cmd;
+	enum adjust_t adjust;
+	int value;
+	unsigned long id;
+	struct synth_t params;    // for MSG_PARAMS and MSG_DONE
+	int len;                  // of the text which follows
+};
+
+/* The socket to the supervisor, in the engine processes */
+static int supervisor_fd = -1;
+static atomic_llong last_heartbeat = 0;
+static atomic_llong last_waiting = 0;
+
+static int send_msg(int fd, const struct engine_msg_t *msg, const char *text,
+                    int flags)
+{
+	struct iovec iov[2] = {
+		{(void *) msg, sizeof(*msg)},
+		{(void *) text, text ? msg->len : 0},
+	};
+	struct msghdr mh = {
+		.msg_iov = iov,
+		.msg_iovlen = text ? 2 : 1,
+	};
+
+	return sendmsg(fd, &mh, flags | MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+/* Supervisor side */
+
+struct engine_t {
+	pid_t pid;
+	int fd;
+};
+
+static struct engine_t active = {0, -1};
+static struct engine_t standby = {0, -1};
+static int signal_fd = -1;
+static sigset_t saved_mask;
+/* When to start a standby engine again, 0 if not waiting to */
+static long long standby_due = 0;
+
+/* What was handed over to the active engine and not played yet, in
+ * order, to be handed over again to the standby one when it takes over.
+ * The commands the engine applied stay behind the texts not played yet,
+ * so that the queue empties from the head. */
+struct pending_t {
+	struct espeak_entry_t entry;
+	int sent;
+	int done;
+};
+static struct queue_t *pending = NULL;
+static unsigned long next_id = 0;
+static int flush_unsent = 0;
+static int send_blocked = 0;
+/* Index marks of the entries pending which the active engine reported,
+ * and which were reported already by the ones before it: replaying an
+ * entry reports its marks again. */
+static int marks_seen = 0;
+static int marks_reported = 0;
+
+/* The voice parameters of the active engine */
+static struct synth_t params;
+static int have_params = 0;
+
+/* When the active engine last made progress, or was given work while it
+ * had none */
+static long long progress_time;
+static long long last_flush = 0;
+/* Failovers since anything was last played */
+static int failovers = 0;
+/* When the active engine took over, until it plays something */
+static long long switch_time = 0;
+
+static void free_pending(struct pending_t *p)
+{
+	if (p->entry.cmd == CMD_SPEAK_TEXT)
+		free(p->entry.buf);
+	free(p);
+}
+
+static void drop_pending(void)
+{
+	struct pending_t *p;
+
+	while ((p = queue_remove(pending)))
+		free_pending(p);
+	marks_seen = 0;
+	marks_reported = 0;
+}
+
+static int send_entry(void *data, void *arg)
+{
+	struct pending_t *p = data;
+	struct engine_msg_t msg = {0};
+	const char *text = NULL;
+
+	if (p->sent)
+		return 0;
+	msg.type = MSG_COMMAND;
+	msg.cmd = p->entry.cmd;
+	msg.adjust = p->entry.adjust;
+	msg.value = p->entry.value;
+	msg.id = p->entry.id;
+	if (p->entry.cmd == CMD_SPEAK_TEXT) {
+		msg.type = MSG_TEXT;
+		msg.len = p->entry.len;
+		text = p->entry.buf;
+	}
+	if (send_msg(active.fd, &msg, text, MSG_DONTWAIT) < 0) {
+		/* Go on once the engine has read some.  If it is gone, the
+		 * standby one gets it all. */
+		send_blocked = 1;
+		return 1;
+	}
+	p->sent = 1;
+	return 0;
+}
+
+// Hand what it does not have yet over to the active engine, in order.
+static void send_pending(void)
+{
+	struct engine_msg_t msg = {0};
+
+	send_blocked = 0;
+	if (!active.pid)
+		return;
+	if (flush_unsent) {
+		msg.type = MSG_FLUSH;
+		if (send_msg(active.fd, &msg, NULL, MSG_DONTWAIT) < 0) {
+			send_blocked = 1;
+			return;
+		}
+		flush_unsent = 0;
+	}
+	queue_foreach(pending, send_entry, NULL);
+}
+
+static void add_pending(enum command_t cmd, enum adjust_t adj, int value,
+                        char *buf, int len)
+{
+	struct pending_t *p = allocMem(sizeof(struct pending_t));
+
+	p->entry.cmd = cmd;
+	p->entry.adjust = adj;
+	p->entry.value = value;
+	p->entry.buf = buf;
+	p->entry.len = len;
+	p->entry.job = -1;
+	p->entry.id = next_id++;
+	p->sent = 0;
+	p->done = 0;
+	// The engine has to make progress from now on.
+	if (!queue_peek(pending))
+		progress_time = monotonic_ns();
+	if (!queue_add(pending, p)) {
+		free_pending(p);
+		return;
+	}
+	send_pending();
+}
+
+static void supervisor_text(void *data, const char *txt, size_t length)
+{
+	size_t n;
+	char *buf;
+
+	length = repeat_filter(txt, length);
+	while (length) {
+		n = length < ENGINE_MAX_TEXT ? length : ENGINE_MAX_TEXT;
+		buf = strndup(txt, n);
+		if (!buf) {
+			perror("unable to allocate space for text");
+			return;
+		}
+		add_pending(CMD_SPEAK_TEXT, ADJ_SET, 0, buf, n);
+		txt += n;
+		length -= n;
+	}
+}
+
+static void supervisor_command(void *data, enum command_t cmd,
+                               enum adjust_t adj, int value)
+{
+	add_pending(cmd, adj, value, NULL, 0);
+}
+
+/* The engine drops what it has not played yet, and so do we: there is
+ * nothing left to hand over again. */
+static void supervisor_flush(void *data)
+{
+	drop_pending();
+	flush_unsent = 1;
+	last_flush = monotonic_ns();
+	repeat_flushed();
+	send_pending();
+}
+
+static const struct parser_callbacks_t supervisor_callbacks = {
+	.text = supervisor_text,
+	.command = supervisor_command,
+	.flush = supervisor_flush,
+};
+
+struct lookup_t {
+	unsigned long id;
+	unsigned long mask;
+	struct pending_t *found;
+};
+
+static int match_entry(void *data, void *arg)
+{
+	struct pending_t *p = data;
+	struct lookup_t *l = arg;
+
+	if ((p->entry.id & l->mask) != l->id)
+		return 0;
+	l->found = p;
+	return 1;
+}
+
+// Entries which were flushed meanwhile are not found.
+static struct pending_t *find_pending(unsigned long id, unsigned long mask)
+{
+	struct lookup_t l = {id & mask, mask, NULL};
+
+	queue_foreach(pending, match_entry, &l);
+	return l.found;
+}
+
+// Forget about the commands applied at the head of the queue.
+static void pop_done(void)
+{
+	struct pending_t *p;
+
+	while ((p = queue_peek(pending)) && p->done)
+		free_pending(queue_remove(pending));
+}
+
+/* A text or mark was played, and so was everything before it: the
+ * commands before it were applied already. */
+static void entry_played(int key)
+{
+	struct pending_t *last = find_pending(key, INT_MAX);
+	struct pending_t *p;
+
+	if (!last)
+		return;
+	do {
+		p = queue_remove(pending);
+		if (p != last)
+			free_pending(p);
+	} while (p != last);
+	free_pending(last);
+	marks_seen = 0;
+	marks_reported = 0;
+	pop_done();
+}
+
+static void command_done(unsigned long id)
+{
+	struct pending_t *p = find_pending(id, ULONG_MAX);
+
+	if (p)
+		p->done = 1;
+	pop_done();
+}
+
+/* Tell the standby engine about the voice parameters of the active one,
+ * as the first thing after taking over.  The texts which were not played
+ * yet will be spoken with the latest parameters, even those which came
+ * before a command which was applied already. */
+static void send_params(void)
+{
+	struct engine_msg_t msg = {0};
+
+	if (!have_params)
+		return;
+	msg.type = MSG_PARAMS;
+	msg.id = next_id++;
+	msg.params = params;
+	(void) send_msg(active.fd, &msg, NULL, 0);
+}
+
+static int replay_entry(void *data, void *arg)
+{
+	struct pending_t *p = data;
+
+	if (!p->done) {
+		p->sent = 0;
+		stats_add(STATS_SUPERVISOR, STAT_ENTRIES_REPLAYED, 1);
+	}
+	return 0;
+}
+
+/* Start an engine: espeakup again, told where the socket to us and the
+ * shared statistics are.  We run threads by then, which may hold locks
+ * at the time of the fork, so the child only makes async-signal-safe
+ * calls until it runs the binary anew.  /proc/self/exe is the binary we
+ * run, even if it was replaced on disk since. */
+static int spawn_engine(struct engine_t *e)
+{
+	static const char execFailed[] = "espeakup: unable to start an engine\n";
+	char arg[64];
+	char **argv;
+	int stats_fd = stats_shared_fd();
+	pid_t parent = getpid();
+	int fds[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0) {
+		perror("Unable to create an engine socket");
+		return -1;
+	}
+	snprintf(arg, sizeof(arg), "--engine=%d,%d", fds[1], stats_fd);
+	argv = restart_arguments(arg);
+	if (!argv) {
+		fprintf(stderr, "Unable to allocate memory.\n");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	pid = fork();
+	if (pid < 0) {
+		perror("Unable to fork an engine");
+		free(argv);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (!pid) {
+		/* Do not outlive the supervisor, nor start when it is gone
+		 * already. */
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		if (getppid() != parent)
+			_exit(1);
+		fcntl(fds[1], F_SETFD, 0);
+		if (stats_fd >= 0)
+			fcntl(stats_fd, F_SETFD, 0);
+		sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+		execv("/proc/self/exe", argv);
+		(void) write(STDERR_FILENO, execFailed, sizeof(execFailed) - 1);
+		_exit(127);
+	}
+	free(argv);
+	close(fds[1]);
+	e->pid = pid;
+	e->fd = fds[0];
+	return 0;
+}
+
+static void retire(struct engine_t *e)
+{
+	if (!e->pid)
+		return;
+	kill(e->pid, SIGKILL);
+	close(e->fd);
+	e->pid = 0;
+	e->fd = -1;
+}
+
+/* Replace the active engine by the standby one, and start a new standby
+ * engine.  Returns -1 when this does not help anymore. */
+static int failover(void)
+{
+	if (++failovers > maxRestarts) {
+		fprintf(stderr, "espeakup: switching engines did not help, "
+		        "aborting\n");
+		return -1;
+	}
+	retire(&active);
+	if (standby.pid) {
+		active = standby;
+		standby.pid = 0;
+		standby.fd = -1;
+	} else if (spawn_engine(&active) < 0) {
+		return -1;
+	}
+	if (!standby_due && spawn_engine(&standby) < 0)
+		standby_due = monotonic_ns() + STANDBY_RESPAWN_NS;
+	stats_add(STATS_SUPERVISOR, STAT_ENGINE_FAILOVERS, 1);
+	PROBE1(failover, failovers);
+	switch_time = monotonic_ns();
+	progress_time = switch_time;
+
+	send_params();
+	queue_foreach(pending, replay_entry, NULL);
+	marks_seen = 0;
+	flush_unsent = 0;
+	send_pending();
+	return 0;
+}
+
+static int engine_lost(struct engine_t *e)
+{
+	if (e == &standby) {
+		fprintf(stderr, "espeakup: the standby engine exited\n");
+		retire(&standby);
+		standby_due = monotonic_ns() + STANDBY_RESPAWN_NS;
+		return 0;
+	}
+	fprintf(stderr, "espeakup: the engine exited, switching to the standby "
+	        "one\n");
+	return failover();
+}
+
+// Returns -1 when the engine is lost, and could not be replaced.
+static int engine_message(struct engine_t *e)
+{
+	struct engine_msg_t msg;
+	ssize_t n;
+	long long now;
+
+	for (;;) {
+		n = recv(e->fd, &msg, sizeof(msg), MSG_DONTWAIT);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return 0;
+		if (n <= 0)
+			return engine_lost(e);
+		// The standby engine has nothing to say yet.
+		if (e != &active || n != sizeof(msg))
+			continue;
+		/* Waiting for a sound device is no stall either: switching
+		 * engines would not bring one. */
+		now = monotonic_ns();
+		progress_time = now;
+		switch (msg.type) {
+		case MSG_MARK:
+			if (msg.value < 0) {
+				entry_played(-1 - msg.value);
+			} else if (++marks_seen > marks_reported) {
+				softsynth_writeindex(msg.value);
+				marks_reported = marks_seen;
+			}
+			failovers = 0;
+			/* fall through */
+		case MSG_PROGRESS:
+			if (switch_time) {
+				stats_add(STATS_SUPERVISOR, STAT_ENGINE_SWITCH_NS,
+				          now - switch_time);
+				stats_max(STATS_SUPERVISOR, STAT_ENGINE_SWITCH_MAX_NS,
+				          now - switch_time);
+				switch_time = 0;
+			}
+			break;
+		case MSG_DONE:
+			command_done(msg.id);
+			/* fall through */
+		case MSG_PARAMS:
+			params = msg.params;
+			have_params = 1;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Returns -1 when an engine is lost, and could not be replaced.
+static int reap_engines(void)
+{
+	pid_t pid;
+
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		if (pid == active.pid && engine_lost(&active) < 0)
+			return -1;
+		if (pid == standby.pid)
+			engine_lost(&standby);
+	}
+	return 0;
+}
+
+/* How long until the active engine is late, or the standby one is to be
+ * started again, in milliseconds, or -1 if there is no hurry. */
+static int next_timeout(long long now)
+{
+	long long deadline = -1;
+	long long since = progress_time;
+
+	if (queue_peek(pending)) {
+		// What comes after a burst of flushes may be held back.
+		if (last_flush + flushDebounce * 1000000LL > since)
+			since = last_flush + flushDebounce * 1000000LL;
+		deadline = since + standbyTimeout * 1000000LL;
+	}
+	if (standby_due && (deadline < 0 || standby_due < deadline))
+		deadline = standby_due;
+	if (deadline < 0)
+		return -1;
+	if (deadline <= now)
+		return 0;
+	return (deadline - now + 999999) / 1000000;
+}
+
+// Ask the engines to stop, and kill those which do not.
+static void stop_engines(void)
+{
+	pid_t pids[2] = {active.pid, standby.pid};
+	long long deadline = monotonic_ns() + stopAckTimeout * 1000000LL;
+	struct timespec ts = {0, 10000000};
+	int left;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!pids[i])
+			continue;
+		kill(pids[i], SIGTERM);
+	}
+	if (active.fd >= 0)
+		close(active.fd);
+	if (standby.fd >= 0)
+		close(standby.fd);
+	do {
+		left = 0;
+		for (i = 0; i < 2; i++) {
+			if (pids[i] && waitpid(pids[i], NULL, WNOHANG) == 0)
+				left++;
+			else
+				pids[i] = 0;
+		}
+		if (left)
+			nanosleep(&ts, NULL);
+	} while (left && monotonic_ns() < deadline);
+	for (i = 0; i < 2; i++) {
+		if (!pids[i])
+			continue;
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+	active.pid = standby.pid = 0;
+	active.fd = standby.fd = -1;
+}
+
+static void handle_signals(struct parser_t *parser)
+{
+	struct signalfd_siginfo si;
+
+	while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+		switch (si.ssi_signo) {
+		case SIGINT:
+		case SIGTERM:
+			should_run = 0;
+			break;
+		case SIGHUP:
+			/* We read the configuration and the substitution
+			 * dictionary again, for what we apply ourselves and for
+			 * the engines started from now on, and so do the running
+			 * engines. */
+			reload_options();
+			reload_speech_parser(parser);
+			if (active.pid)
+				kill(active.pid, SIGHUP);
+			if (standby.pid)
+				kill(standby.pid, SIGHUP);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* Run as the supervisor of the engine processes.  Reports the startup
+ * status on status_fd, if any, and sends the service manager watchdog
+ * heartbeats if asked to.  Returns the exit status. */
+int supervise(int status_fd, int watchdog)
+{
+	struct parser_t *parser;
+	struct pollfd pfd[4];
+	pthread_t stats_thread_id;
+	pthread_t watchdog_thread_id;
+	sigset_t sigset;
+	char buf[PARSER_MAX_INPUT];
+	char ret = 0;
+	int input_fd;
+	ssize_t length;
+	long long now;
+
+	pending = new_queue();
+	if (!pending) {
+		fprintf(stderr, "Unable to allocate memory.\n");
+		return 2;
+	}
+	// The engines count, the supervisor serves.
+	if (stats_enabled() && stats_share() < 0)
+		fprintf(stderr, "Unable to share the statistics with the "
+		        "engines.\n");
+
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	sigaddset(&sigset, SIGHUP);
+	sigaddset(&sigset, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &sigset, &saved_mask);
+	signal_fd = signalfd(-1, &sigset, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0) {
+		perror("Unable to receive signals");
+		return 4;
+	}
+
+	input_fd = open_softsynth();
+	if (input_fd < 0)
+		return 2;
+	if (spawn_engine(&active) < 0)
+		return 4;
+	if (spawn_engine(&standby) < 0)
+		standby_due = monotonic_ns() + STANDBY_RESPAWN_NS;
+	parser = new_speech_parser(&supervisor_callbacks, NULL);
+
+	if (stats_enabled() &&
+	    create_thread(&stats_thread_id, stats_thread, NULL, 0) != 0)
+		ret = 4;
+	if (!ret && watchdog &&
+	    create_thread(&watchdog_thread_id, watchdog_thread, NULL, 0) != 0)
+		ret = 4;
+	if (ret) {
+		should_run = 0;
+		stop_engines();
+		return ret;
+	}
+	if (status_fd >= 0)
+		(void) write(status_fd, &ret, 1);
+
+	while (should_run) {
+		pfd[0].fd = signal_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = input_fd;
+		pfd[1].events = POLLIN;
+		pfd[2].fd = active.fd;
+		pfd[2].events = POLLIN | (send_blocked ? POLLOUT : 0);
+		pfd[3].fd = standby.fd;
+		pfd[3].events = POLLIN;
+
+		if (poll(pfd, 4, next_timeout(monotonic_ns())) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Poll failed");
+			break;
+		}
+
+		if (pfd[0].revents)
+			handle_signals(parser);
+		if (reap_engines() < 0) {
+			ret = 3;
+			break;
+		}
+
+		if (pfd[1].revents) {
+			length = read(input_fd, buf, sizeof(buf));
+			if (length < 0 && errno != EAGAIN && errno != EINTR) {
+				perror("Read from softsynth failed");
+				break;
+			}
+			if (length == 0) {
+				// End of input: keep speaking what came in.
+				input_fd = -1;
+			} else if (length > 0) {
+				stats_add(STATS_SOFTSYNTH, STAT_BYTES_READ, length);
+				PROBE1(read, length);
+				parser_feed(parser, buf, length);
+			}
+		}
+
+		if (pfd[2].fd == active.fd && pfd[2].revents) {
+			if (engine_message(&active) < 0) {
+				ret = 3;
+				break;
+			}
+			if (send_blocked && (pfd[2].revents & POLLOUT))
+				send_pending();
+		}
+		if (pfd[3].fd == standby.fd && pfd[3].revents)
+			engine_message(&standby);
+
+		now = monotonic_ns();
+		if (standby_due && now >= standby_due) {
+			standby_due = 0;
+			if (!standby.pid && spawn_engine(&standby) < 0)
+				standby_due = now + STANDBY_RESPAWN_NS;
+		}
+		if (queue_peek(pending) && !next_timeout(now)) {
+			fprintf(stderr, "espeakup: the engine made no progress for %d "
+			        "ms, switching to the standby one\n", standbyTimeout);
+			if (failover() < 0) {
+				ret = 3;
+				break;
+			}
+		}
+	}
+
+	should_run = 0;
+	stop_engines();
+	if (stats_enabled())
+		pthread_join(stats_thread_id, NULL);
+	if (watchdog)
+		pthread_join(watchdog_thread_id, NULL);
+	free_parser(parser);
+	drop_pending();
+	free(pending);
+	close_softsynth();
+	return ret;
+}
+
+/* Engine process side */
+
+/* Set up as an engine process, given "<socket>,<statistics>": the file
+ * descriptors of the socket to the supervisor and of the statistics it
+ * shares, -1 if it does not.  Returns -1 if arg is invalid. */
+int engine_init(const char *arg)
+{
+	int fd, stats_fd;
+
+	// The command line is gone through twice.
+	if (supervisor_fd >= 0)
+		return 0;
+	if (sscanf(arg, "%d,%d", &fd, &stats_fd) != 2 || fd < 0)
+		return -1;
+	if (stats_fd >= 0 && stats_attach(stats_fd) < 0)
+		fprintf(stderr, "Unable to share the statistics with the "
+		        "supervisor.\n");
+	supervisor_fd = fd;
+	return 0;
+}
+
+int engine_process(void)
+{
+	return supervisor_fd >= 0;
+}
+
+int engine_socket(void)
+{
+	return supervisor_fd;
+}
+
+static void report(enum engine_msg_type_t type, int value, unsigned long id,
+                   const struct synth_t *s, int flags)
+{
+	struct engine_msg_t msg = {0};
+
+	msg.type = type;
+	msg.value = value;
+	msg.id = id;
+	if (s)
+		msg.params = *s;
+	(void) send_msg(supervisor_fd, &msg, NULL, flags);
+}
+
+/* Read what the supervisor sent, and pass it on to the parser callbacks,
+ * with the id of the entry as their data.  Returns the size of the
+ * message, 0 once the supervisor is gone, or -1 on error. */
+int engine_read(const struct parser_callbacks_t *cb)
+{
+	static union {
+		struct engine_msg_t msg;
+		char buf[sizeof(struct engine_msg_t) + ENGINE_MAX_TEXT];
+	} in;
+	struct engine_msg_t *msg = &in.msg;
+	struct synth_t *p = &msg->params;
+	ssize_t n;
+
+	n = recv(supervisor_fd, in.buf, sizeof(in.buf), 0);
+	if (n < (ssize_t) sizeof(*msg) || msg->len < 0 ||
+	    (size_t) n - sizeof(*msg) != (size_t) msg->len)
+		return n;
+
+	switch (msg->type) {
+	case MSG_TEXT:
+		cb->text(&msg->id, in.buf + sizeof(*msg), msg->len);
+		break;
+	case MSG_COMMAND:
+		cb->command(&msg->id, msg->cmd, msg->adjust, msg->value);
+		break;
+	case MSG_FLUSH:
+		cb->flush(NULL);
+		break;
+	case MSG_PARAMS:
+		cb->command(&msg->id, CMD_SET_FREQUENCY, ADJ_SET, p->frequency);
+		cb->command(&msg->id, CMD_SET_PITCH, ADJ_SET, p->pitch);
+		cb->command(&msg->id, CMD_SET_RANGE, ADJ_SET, p->range);
+		cb->command(&msg->id, CMD_SET_PUNCTUATION, ADJ_SET, p->punct);
+		cb->command(&msg->id, CMD_SET_RATE, ADJ_SET, p->rate);
+		cb->command(&msg->id, CMD_SET_VOLUME, ADJ_SET, p->volume);
+		break;
+	default:
+		break;
+	}
+	return n;
+}
+
+/* The espeak thread processed an entry.  Texts and marks are done once
+ * played, commands right away. */
+void engine_done(const struct espeak_entry_t *entry, const struct synth_t *s)
+{
+	if (supervisor_fd < 0)
+		return;
+	if (entry->cmd == CMD_SPEAK_TEXT || entry->cmd == CMD_SET_MARK)
+		audio_mark(ENGINE_PLAYED_MARK(entry->id));
+	else
+		report(MSG_DONE, 0, entry->id, s, 0);
+}
+
+// The voice parameters changed other than by a command.
+void engine_params(const struct synth_t *s)
+{
+	if (supervisor_fd >= 0)
+		report(MSG_PARAMS, 0, 0, s, 0);
+}
+
+// An index mark, or an entry, was played.
+void engine_report(int value)
+{
+	report(MSG_MARK, value, 0, NULL, 0);
+}
+
+/* Audio was synthesized or played: tell the supervisor, now and then. */
+void engine_progress(void)
+{
+	long long now;
+
+	if (supervisor_fd < 0)
+		return;
+	now = monotonic_ns();
+	if (now - atomic_load_explicit(&last_heartbeat, memory_order_relaxed) <
+	    standbyTimeout * 1000000LL / 4)
+		return;
+	atomic_store_explicit(&last_heartbeat, now, memory_order_relaxed);
+	report(MSG_PROGRESS, 0, 0, NULL, MSG_DONTWAIT);
+}
+
+/* There is no sound device to play on: tell the supervisor, now and then,
+ * that it is being waited for. */
+void engine_waiting(void)
+{
+	long long now;
+
+	if (supervisor_fd < 0)
+		return;
+	now = monotonic_ns();
+	if (now - atomic_load_explicit(&last_waiting, memory_order_relaxed) <
+	    standbyTimeout * 1000000LL / 4)
+		return;
+	atomic_store_explicit(&last_waiting, now, memory_order_relaxed);
+	report(MSG_WAITING, 0, 0, NULL, MSG_DONTWAIT);
+}
@@ -0,0 +1,48 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ENGINE_H
+#define __ENGINE_H
+
+#include <limits.h>
+
+struct espeak_entry_t;
+struct parser_callbacks_t;
+struct synth_t;
+
+/* The engine reports the entries it has played through the index marks
+ * of its audio ring, with negative values: those of Speakup are not. */
+#define ENGINE_PLAYED_MARK(id) (-1 - (int) ((id) & INT_MAX))
+
+/* Supervisor side */
+extern int supervise(int status_fd, int watchdog);
+
+/* Engine process side */
+extern int engine_init(const char *arg);
+extern int engine_process(void);
+extern int engine_socket(void);
+extern int engine_read(const struct parser_callbacks_t *cb);
+extern void engine_done(const struct espeak_entry_t *entry,
+                        const struct synth_t *s);
+extern void engine_params(const struct synth_t *s);
+extern void engine_report(int value);
+extern void engine_progress(void);
+extern void engine_waiting(void);
+
+#endif
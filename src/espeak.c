@@ -20,7 +20,11 @@
 #define _GNU_SOURCE
 #include <alsa/asoundlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <malloc.h>
 #include <math.h>
+#include <signal.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,62 +32,405 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "cache.h"
+#include "engine.h"
 #include "espeakup.h"
+#include "pool.h"
+#include "probes.h"
+#include "realtime.h"
+#include "runs.h"
+#include "stats.h"
+#include "stretch.h"
+#include "stringhandling.h"
+#include "trim.h"
+#include "watchdog.h"
 
 /* default voice settings */
-const int defaultFrequency = 5;
-const int defaultPitch = 5;
-const int defaultRange = 5;
-const int defaultRate = 2;
-const int defaultVolume = 5;
+int defaultFrequency = 5;
+int defaultPitch = 5;
+int defaultRange = 5;
+int defaultRate = 2;
+int defaultVolume = 5;
 char *defaultVoice = NULL;
 int alsaVolume = 0;
 
+/* The default voice last applied, to tell whether a reload changed it. */
+static char appliedVoice[sizeof(((struct synth_t *) 0)->voice)];
+
 /* multipliers and offsets */
-const int frequencyMultiplier = 11;
-const int pitchMultiplier = 11;
-const int rangeMultiplier = 11;
-const int rateMultiplier = 41;
-const int rateOffset = 80;
-const int volumeMultiplier = 22;
+int frequencyMultiplier = 11;
+int pitchMultiplier = 11;
+int rangeMultiplier = 11;
+int rateMultiplier = 41;
+int rateOffset = 80;
+int volumeMultiplier = 22;
+
+/* PCM cache sizes, in KiB.  A cache size of 0 disables the cache. */
+int cacheSize = 2048;
+int cacheEntrySize = 256;
+
+/* Only short texts are worth caching: prompts, menu items, key echo.
+ * Long say-all chunks hardly ever come back. */
+static const int maxCachedText = 1024;
+
+/* Number of synthesis worker processes, 0 to synthesize in the main
+ * process only, and how far ahead in the queue to look for texts to hand
+ * over to them. */
+int synthWorkers = 0;
+static const int maxLookahead = 64;
+
+/* Length of the audio buffers espeak hands to the synth callback, in
+ * milliseconds, 0 for the espeak-ng default (60ms).  Shorter buffers make
+ * a stop request noticed sooner, at the cost of more callbacks. */
+int bufferLength = 0;
+
+/* Silence trimming (see trim.c): the RMS amplitude below which audio is
+ * silence, 0 to disable trimming, the longest pause kept, in
+ * milliseconds, and the longest text trimmed.  Long texts keep their
+ * natural pauses. */
+int trimThreshold = 0;
+int trimMaxPause = 50;
+int trimTextLength = 64;
+
+/* Idle policy: after idleTimeout seconds without input, 0 to never, the
+ * audio device is released and freed memory is returned to the system.
+ * With idleSuspend, the engine is also shut down, to be started again on
+ * the next input, which delays it. */
+int idleTimeout = 0;
+int idleSuspend = 0;
+static int idle = 0;
+
+/* Runs of more than that many times the same symbol are collapsed (see
+ * runs.c), 0 to disable it. */
+int collapseRuns = 0;
+
+/* How much faster than espeak's top rate speech may get: rates above 5
+ * are also time-compressed (see stretch.c), by up to rateBoost at rate
+ * 9.  1 disables it. */
+double rateBoost = 1.0;
+
+/* Size of the pieces cached audio is replayed in, so that a stop request
+ * is noticed quickly (about 20ms at 22050Hz). */
+static const int replayChunk = 441;
 
 volatile int stop_requested = 0;
+volatile int reload_requested = 0;
 int paused_espeak = 1;
 
-/* Wedged-engine detection.  Espeak may legitimately refuse entries for a
- * while (EE_BUFFER_FULL while a long backlog is being played back), so a
- * failing entry is normally just retried.  But when entries keep failing
- * while the synth callback reports no progress at all, the audio output
- * is most likely wedged (e.g. an ALSA device stuck returning EBUSY).
- * After ESPEAK_STALL_RETRIES consecutive such retries (about one second
- * each), restart the engine; after ESPEAK_MAX_RESTARTS restarts without
- * the engine having been healthy for ESPEAK_HEALTHY_SECS in between,
- * give up and exit, so that the init system can respawn us. */
-#define ESPEAK_STALL_RETRIES 10
-#define ESPEAK_MAX_RESTARTS 3
-#define ESPEAK_HEALTHY_SECS 60
+/* Wedged-engine detection.  An entry may legitimately fail for a while
+ * (the audio output failing over to another device), so a failing entry
+ * is normally just retried.  But when entries keep failing while the
+ * synth callback reports no progress at all, the audio output is most
+ * likely wedged (e.g. an ALSA device stuck returning EBUSY).
+ * After stallTimeout milliseconds of such retries, restart the engine;
+ * after maxRestarts restarts without the engine having been healthy for
+ * healthyTime seconds in between, give up and exit, so that the init
+ * system can respawn us. */
+int stallTimeout = 3000;        // in milliseconds
+int maxRestarts = 3;
+int healthyTime = 60;          // in seconds
 
 /* Set by the synth callback whenever espeak makes synthesis progress;
- * used to tell a merely backlogged engine from a wedged one.  The
- * callback runs in espeak's own thread, so the flag is atomic. */
+ * used to tell a merely backlogged engine from a wedged one. */
 static atomic_int synth_progressed = 0;
 static int stalled_retries = 0;
+static long long stalled_since = 0;
 static int restart_attempts = 0;
 static struct timespec last_restart;
 
+/* Failing entries are retried after a delay which starts short, so that
+ * speech resumes as soon as espeak accepts them again, and doubles up to
+ * a tenth of stallTimeout on each consecutive failure.  The playback
+ * thread ends the wait early when it plays something, as that is what
+ * frees espeak up. */
+#define RETRY_MIN_NS 5000000LL
+static long long retry_delay = RETRY_MIN_NS;
+static atomic_int retry_waiting = 0;
+
+// Espeak produced audio: it is not wedged.
+static void synth_progress(void)
+{
+	atomic_store(&synth_progressed, 1);
+	watchdog_progress();
+	engine_progress();
+}
+
+static int sample_rate = 22050;
+static struct pcm_cache_t *pcm_cache = NULL;
+
+// The entry being processed, for the probes
+static unsigned long entry_id;
+
+/* Samples produced so far by the current espeak_Synth call, and whether
+ * playing them failed. */
+static int synth_position;
+static int audio_failed;
+
+/* Output stages between synthesis and playback */
+#define OUTPUT_BLOCK 1024
+static struct trim_t trim;
+static short output_buf[OUTPUT_BLOCK];
+static struct stretch_t *stretch = NULL;
+static short stretch_buf[OUTPUT_BLOCK];
+static int stretching;
+
+/* Time between two calls of the synth callback within an utterance, and
+ * the audio they carry. */
+static long long last_callback;
+static struct duration_stats_t callback_interval;
+static struct duration_stats_t callback_audio;
+
+/* Audio of the utterance being synthesized, added to the cache once the
+ * utterance is complete. */
+#define CAPTURE_MAX_MARKS 64
+static struct {
+	int active;
+	short *samples;
+	int nsamples;
+	int size;
+	struct pcm_mark_t marks[CAPTURE_MAX_MARKS];
+	int nmarks;
+} capture;
+
+static void capture_samples(const short *wav, int numsamples)
+{
+	if (!capture.active)
+		return;
+	if (capture.nsamples + numsamples > capture.size) {
+		// Too long to be cached anyway.
+		capture.active = 0;
+		return;
+	}
+	memcpy(capture.samples + capture.nsamples, wav,
+	       numsamples * sizeof(short));
+	capture.nsamples += numsamples;
+}
+
+static void capture_mark(int offset, int value)
+{
+	if (!capture.active)
+		return;
+	if (capture.nmarks == CAPTURE_MAX_MARKS) {
+		capture.active = 0;
+		return;
+	}
+	capture.marks[capture.nmarks].offset = offset;
+	capture.marks[capture.nmarks].value = value;
+	capture.nmarks++;
+}
+
+static double rate_tempo(int rate)
+{
+	if (rateBoost <= 1.0 || rate <= 5)
+		return 1.0;
+	if (rate > 9)
+		rate = 9;
+	return pow(rateBoost, (rate - 5) / 4.0);
+}
+
+/* Set the output stages up for an utterance. */
+static void output_start(struct synth_t *s)
+{
+	double tempo = rate_tempo(s->rate);
+
+	trim_start(&trim, trimThreshold && s->len <= trimTextLength);
+	stretching = stretch && tempo > 1.0;
+	if (stretching)
+		stretch_start(stretch, tempo);
+}
+
+/* Queue samples for playing, time-compressed if needed. */
+static int output_stretched(const short *samples, int n)
+{
+	int count;
+
+	if (!stretching)
+		return audio_write(samples, n);
+	stretch_put(stretch, samples, n);
+	while ((count = stretch_get(stretch, stretch_buf, OUTPUT_BLOCK)) > 0)
+		if (audio_write(stretch_buf, count) < 0)
+			return -1;
+	return 0;
+}
+
+/* The utterance is complete: let out what the output stages still hold. */
+static espeak_ERROR output_finish(espeak_ERROR rc)
+{
+	int count;
+
+	if (!stretching || rc != EE_OK || stop_requested)
+		return rc;
+	stretch_drain(stretch);
+	while ((count = stretch_get(stretch, stretch_buf, OUTPUT_BLOCK)) > 0)
+		if (audio_write(stretch_buf, count) < 0)
+			return EE_INTERNAL_ERROR;
+	return EE_OK;
+}
+
+/* Run samples through the output stages, and queue them for playing. */
+static int output_samples(const short *samples, int n)
+{
+	int count, kept;
+
+	if (!trim.active)
+		return output_stretched(samples, n);
+	while (n > 0) {
+		count = n < OUTPUT_BLOCK ? n : OUTPUT_BLOCK;
+		kept = trim_samples(&trim, samples, count, output_buf);
+		if (kept && output_stretched(output_buf, kept) < 0)
+			return -1;
+		samples += count;
+		n -= count;
+	}
+	return 0;
+}
+
+/* Play the samples of wav from *done up to upto. */
+static int play_until(const short *wav, int *done, int upto, int numsamples)
+{
+	if (upto > numsamples)
+		upto = numsamples;
+	if (upto <= *done)
+		return 0;
+	if (output_samples(wav + *done, upto - *done) < 0)
+		return -1;
+	*done = upto;
+	return 0;
+}
+
+/* Espeak runs in synchronous mode, in the espeak thread: espeak_Synth
+ * returns once it has handed all the audio over to this callback, which
+ * queues it for playing, with each index mark in between, to be reported
+ * once the audio before it has been played. */
 static int callback(short *wav, int numsamples, espeak_EVENT *events)
 {
+	long long now;
+	int done = 0;
 	int i;
-	atomic_store(&synth_progressed, 1);
+
+	if (stop_requested)
+		// Everything is being flushed, abort the synthesis.
+		return 1;
+	if (!wav)
+		numsamples = 0;
+	PROBE2(synth_callback, entry_id, numsamples);
+	now = monotonic_ns();
+	if (last_callback)
+		duration_add(&callback_interval, now - last_callback);
+	last_callback = now;
+	if (numsamples)
+		duration_add(&callback_audio,
+		             numsamples * 1000000000LL / sample_rate);
+	capture_samples(wav, numsamples);
 	for (i = 0; events[i].type != espeakEVENT_LIST_TERMINATED; i++) {
 		if (events[i].type == espeakEVENT_MARK) {
 			int mark = atoi(events[i].id.name);
+			int offset;
 			if ((mark < 0) || (mark > 255))
 				continue;
-			softsynth_reportindex(mark);
+			offset = (long) events[i].audio_position * sample_rate / 1000 -
+			         synth_position;
+			if (play_until(wav, &done, offset, numsamples) < 0)
+				goto failed;
+			capture_mark(synth_position + done, mark);
+			if (audio_mark(mark) < 0)
+				goto failed;
 		}
 	}
+	if (play_until(wav, &done, numsamples, numsamples) < 0)
+		goto failed;
+	synth_position += numsamples;
+	synth_progress();
 	return 0;
+
+failed:
+	audio_failed = 1;
+	capture.active = 0;
+	return 1;
+}
+
+/* The synthesis calls whose audio is not all played yet, the CPU time
+ * they took, and where their audio ends: a flush wastes them. */
+static int unplayed_synths;
+static long long unplayed_cpu_ns;
+static uint64_t unplayed_end;
+static int unplayed_cut;        // a flush interrupted the last one
+
+static void add_unplayed(long long cpu_ns)
+{
+	if (!unplayed_cut && audio_played_pos() >= unplayed_end) {
+		unplayed_synths = 0;
+		unplayed_cpu_ns = 0;
+	}
+	unplayed_synths++;
+	unplayed_cpu_ns += cpu_ns;
+	unplayed_end = audio_queued_pos();
+	if (stop_requested)
+		unplayed_cut = 1;
+}
+
+// Called on a flush, before the audio is dropped.
+static void count_wasted_synthesis(void)
+{
+	if (unplayed_cut || audio_played_pos() < unplayed_end) {
+		stats_add(STATS_ESPEAK, STAT_WASTED_SYNTHS, unplayed_synths);
+		stats_add(STATS_ESPEAK, STAT_WASTED_SYNTH_NS, unplayed_cpu_ns);
+	}
+	unplayed_synths = 0;
+	unplayed_cpu_ns = 0;
+	unplayed_cut = 0;
+}
+
+static espeak_ERROR synth(const char *buf, size_t size, unsigned int flags)
+{
+	espeak_ERROR rc;
+	long long start, elapsed, cpu;
+
+	synth_position = 0;
+	audio_failed = 0;
+	last_callback = 0;
+	start = monotonic_ns();
+	cpu = thread_cpu_ns();
+	PROBE2(synth_start, entry_id, size);
+	rc = espeak_Synth(buf, size, 0, POS_CHARACTER, 0, flags, NULL, NULL);
+	PROBE2(synth_end, entry_id, rc);
+	elapsed = monotonic_ns() - start;
+	add_unplayed(thread_cpu_ns() - cpu);
+	stats_add(STATS_ESPEAK, STAT_SYNTH_CALLS, 1);
+	stats_add(STATS_ESPEAK, STAT_SYNTH_NS, elapsed);
+	stats_max(STATS_ESPEAK, STAT_SYNTH_MAX_NS, elapsed);
+	if (rc == EE_OK && audio_failed)
+		rc = EE_INTERNAL_ERROR;
+	return rc;
+}
+
+/* Play audio from the cache, marks included. */
+static espeak_ERROR replay_audio(const short *samples, int nsamples,
+                                 const struct pcm_mark_t *marks, int nmarks)
+{
+	int done = 0;
+	int next;
+	int m = 0;
+
+	while (done < nsamples || m < nmarks) {
+		if (stop_requested)
+			return EE_OK;
+		next = done + replayChunk;
+		if (m < nmarks && marks[m].offset < next)
+			next = marks[m].offset;
+		if (next > nsamples)
+			next = nsamples;
+		if (next > done) {
+			if (output_samples(samples + done, next - done) < 0)
+				return EE_INTERNAL_ERROR;
+			done = next;
+		}
+		while (m < nmarks && (marks[m].offset <= done || done == nsamples))
+			if (audio_mark(marks[m++].value) < 0)
+				return EE_INTERNAL_ERROR;
+		synth_progress();
+	}
+	return EE_OK;
 }
 
 static espeak_ERROR set_frequency(struct synth_t *s, int freq,
@@ -290,59 +637,414 @@ static espeak_ERROR stop_speech(void)
 	espeak_ERROR rc;
 
 	rc = espeak_Cancel();
+	audio_stop();
 	return rc;
 }
 
-static espeak_ERROR speak_text(struct synth_t *s)
+/* The cache key of a text: the text itself, and everything which affects
+ * how it sounds. */
+static int cache_key(struct synth_t *s, char *key, size_t size)
 {
-	espeak_ERROR rc;
-	int synth_mode = 0;
+	int n;
+
+	n = snprintf(key, size, "%d %d %d %d %d %d %d %s\n", espeakup_mode,
+	             s->frequency, s->pitch, s->range, s->rate, s->volume,
+	             s->punct, s->voice);
+	if (n < 0 || (size_t) (n + s->len) > size)
+		return 0;
+	memcpy(key + n, s->buf, s->len);
+	return n + s->len;
+}
+
+/* Work out what to hand espeak for a text: a single character is spelled
+ * out, and long runs of a symbol are collapsed, into the symbol and its
+ * count if punctuation is spoken.  The result is to be freed if it is not
+ * buf itself. */
+static char *synth_input(char *buf, int len, int punct, size_t *size,
+                         unsigned int *flags)
+{
+	char *ssml;
+	char *collapsed;
+	int collapsed_l;
+	int n;
 
+	*size = len + 1;
+	*flags = 0;
 	if (espeakup_mode == ESPEAKUP_MODE_ACSINT)
-		synth_mode |= espeakSSML;
+		*flags |= espeakSSML;
 
-	if (espeakup_mode == ESPEAKUP_MODE_SPEAKUP && (s->len == 1)) {
-		char *buf;
-		int n;
-		if (s->buf[0] == ' ')
-			n = asprintf(&buf,
+	if (espeakup_mode == ESPEAKUP_MODE_SPEAKUP && collapseRuns &&
+	    len > collapseRuns) {
+		collapsed = initString(&collapsed_l);
+		if (collapse_runs(buf, len, collapseRuns, punct >= 3, &collapsed,
+		                  &collapsed_l)) {
+			*size = collapsed_l + 1;
+			return collapsed;
+		}
+	}
+
+	if (espeakup_mode == ESPEAKUP_MODE_SPEAKUP && len == 1) {
+		if (buf[0] == ' ')
+			n = asprintf(&ssml,
 			             "<say-as interpret-as=\"tts:char\">&#32;</say-as>");
 		else
-			n = asprintf(&buf,
+			n = asprintf(&ssml,
 			             "<say-as interpret-as=\"characters\">%c</say-as>",
-			             s->buf[0]);
-		if (n == -1) {
-			/* D'oh.  Not much to do on allocation failure.
-			 * Perhaps espeak will happen to say the character */
-			rc = espeak_Synth(s->buf, s->len + 1, 0, POS_CHARACTER, 0,
-			                  synth_mode, NULL, NULL);
-		} else {
-			rc = espeak_Synth(buf, n + 1, 0, POS_CHARACTER, 0, espeakSSML, NULL,
-			                  NULL);
+			             buf[0]);
+		/* D'oh.  Not much to do on allocation failure.
+		 * Perhaps espeak will happen to say the character */
+		if (n != -1) {
+			*size = n + 1;
+			*flags = espeakSSML;
+			return ssml;
+		}
+	}
+	return buf;
+}
+
+/* Play the audio of a text rendered by a synthesis worker, as it comes.
+ * Returns -1 if the worker failed before rendering anything, so that the
+ * text is to be synthesized here instead. */
+static int play_job(int job, espeak_ERROR *rc)
+{
+	enum pool_job_status_t status;
+	const struct pcm_mark_t *mark = NULL;
+	const short *samples;
+	long written;
+	long pos = 0;
+	int nmarks;
+	int m = 0;
+	int n;
+
+	*rc = EE_OK;
+	for (;;) {
+		if (stop_requested)
+			return 0;
+		status = pool_job_poll(job, &written, &nmarks);
+		while (m < nmarks) {
+			mark = pool_job_mark(job, m);
+			if (mark->offset > pos &&
+			    (status == POOL_JOB_RUNNING || pos < written))
+				break;
+			capture_mark(pos, mark->value);
+			if (audio_mark(mark->value) < 0) {
+				*rc = EE_INTERNAL_ERROR;
+				return 0;
+			}
+			m++;
+		}
+		if (pos < written) {
+			n = pool_job_samples(job, pos, &samples);
+			if (m < nmarks && mark->offset - pos < n)
+				n = mark->offset - pos;
+			if (n > replayChunk)
+				n = replayChunk;
+			capture_samples(samples, n);
+			if (output_samples(samples, n) < 0) {
+				*rc = EE_INTERNAL_ERROR;
+				return 0;
+			}
+			pos += n;
+			pool_job_consumed(job, pos);
+			synth_progress();
+			continue;
+		}
+		if (status == POOL_JOB_DONE)
+			return 0;
+		if (status == POOL_JOB_FAILED)
+			return pos ? 0 : -1;
+		// Synthesis is behind playback, wait for a bit more audio.
+		pool_job_wait(job, written, &stop_requested);
+	}
+}
+
+static espeak_ERROR speak_text(struct synth_t *s, int *job)
+{
+	espeak_ERROR rc;
+	unsigned int flags;
+	size_t size;
+	char *buf;
+	char key[maxCachedText + 128];
+	int key_len = 0;
+
+	output_start(s);
+	if (pcm_cache && s->len <= maxCachedText)
+		key_len = cache_key(s, key, sizeof(key));
+	if (key_len) {
+		const short *samples;
+		const struct pcm_mark_t *marks;
+		int nsamples, nmarks;
+
+		if (pcm_cache_lookup(pcm_cache, key, key_len, &samples, &nsamples,
+		                     &marks, &nmarks)) {
+			if (*job >= 0) {
+				pool_release(*job);
+				*job = -1;
+			}
+			rc = replay_audio(samples, nsamples, marks, nmarks);
+			return output_finish(rc);
+		}
+		capture.active = 1;
+		capture.nsamples = 0;
+		capture.nmarks = 0;
+	}
+
+	if (*job < 0 || play_job(*job, &rc) < 0) {
+		buf = synth_input(s->buf, s->len, s->punct, &size, &flags);
+		rc = synth(buf, size, flags);
+		if (buf != s->buf)
 			free(buf);
+	}
+	if (*job >= 0 && rc != EE_OK) {
+		// The entry will be retried, but the job cannot be played again.
+		pool_release(*job);
+		*job = -1;
+	}
+
+	if (key_len && capture.active && rc == EE_OK && !stop_requested)
+		pcm_cache_insert(pcm_cache, key, key_len, capture.samples,
+		                 capture.nsamples, capture.marks, capture.nmarks);
+	capture.active = 0;
+	return output_finish(rc);
+}
+
+/* Synthesis workers (see pool.c): each runs its own engine, and renders
+ * the texts it is handed into its slot of the pool. */
+static int worker_job;
+static struct synth_t worker_synth;
+static volatile sig_atomic_t worker_reload = 0;
+
+static void worker_sighup(int sig)
+{
+	worker_reload = 1;
+}
+
+static int worker_callback(short *wav, int numsamples, espeak_EVENT *events)
+{
+	int i;
+
+	if (pool_job_cancelled(worker_job))
+		return 1;
+	for (i = 0; events[i].type != espeakEVENT_LIST_TERMINATED; i++) {
+		if (events[i].type == espeakEVENT_MARK) {
+			int mark = atoi(events[i].id.name);
+			if ((mark < 0) || (mark > 255))
+				continue;
+			if (pool_job_add_mark(worker_job,
+			                      (long) events[i].audio_position *
+			                          sample_rate / 1000,
+			                      mark) < 0)
+				return 1;
 		}
-	} else
-		rc = espeak_Synth(s->buf, s->len + 1, 0, POS_CHARACTER, 0, synth_mode,
-		                  NULL, NULL);
-	return rc;
+	}
+	if (wav && numsamples > 0 &&
+	    pool_job_write(worker_job, wav, numsamples) < 0)
+		return 1;
+	return 0;
+}
+
+static int worker_init(void)
+{
+	int rate;
+	struct sigaction sa;
+
+	rate = espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, bufferLength, NULL, 0);
+	if (rate < 0) {
+		fprintf(stderr, "Unable to initialize espeak in a worker.\n");
+		return -1;
+	}
+	sample_rate = rate;
+	espeak_SetSynthCallback(worker_callback);
+	espeak_SetParameter(espeakCAPITALS, 0, 0);
+	/* The main process forwards SIGHUP, to reload the configuration
+	 * before the next job.  Do not interrupt the wait for a job. */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = worker_sighup;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGHUP, &sa, NULL);
+	/* Make sure that the parameters of the first job all get applied. */
+	worker_synth.frequency = worker_synth.pitch = worker_synth.range =
+		worker_synth.punct = worker_synth.rate = worker_synth.volume =
+			INT_MIN;
+	return 0;
+}
+
+static int worker_render(int job, const struct synth_t *params,
+                         const char *text, int len)
+{
+	espeak_ERROR rc;
+	unsigned int flags;
+	size_t size;
+	char *buf;
+
+	worker_job = job;
+	if (worker_reload) {
+		worker_reload = 0;
+		reload_options();
+		// The multipliers may have changed: apply everything again.
+		worker_synth.frequency = worker_synth.pitch = worker_synth.range =
+			worker_synth.rate = worker_synth.volume = INT_MIN;
+	}
+	if (strcmp(params->voice, worker_synth.voice))
+		set_voice(&worker_synth, (char *) params->voice);
+	if (params->frequency != worker_synth.frequency)
+		set_frequency(&worker_synth, params->frequency, ADJ_SET);
+	if (params->pitch != worker_synth.pitch)
+		set_pitch(&worker_synth, params->pitch, ADJ_SET);
+	if (params->range != worker_synth.range)
+		set_range(&worker_synth, params->range, ADJ_SET);
+	if (params->punct != worker_synth.punct)
+		set_punctuation(&worker_synth, params->punct, ADJ_SET);
+	if (params->rate != worker_synth.rate)
+		set_rate(&worker_synth, params->rate, ADJ_SET);
+	if (params->volume != worker_synth.volume) {
+		// Not set_volume: the main process drives the ALSA volume.
+		espeak_SetParameter(espeakVOLUME,
+		                    (params->volume + 1) * volumeMultiplier, 0);
+		worker_synth.volume = params->volume;
+	}
+
+	/* Synchronous: the job is all in the slot when espeak_Synth returns,
+	 * and can be marked finished. */
+	buf = synth_input((char *) text, len, params->punct, &size, &flags);
+	rc = espeak_Synth(buf, size, 0, POS_CHARACTER, 0, flags, NULL, NULL);
+	if (buf != text)
+		free(buf);
+	return rc == EE_OK ? 0 : -1;
+}
+
+int start_synthesis_workers(void)
+{
+	if (synthWorkers <= 0)
+		return 0;
+	return pool_start(synthWorkers, worker_init, worker_render);
+}
+
+static int adjust_value(int current, int value, enum adjust_t adj)
+{
+	if (adj == ADJ_DEC)
+		value = -value;
+	if (adj != ADJ_SET)
+		value += current;
+	return value;
+}
+
+/* Track what a voice parameter command will set, without applying it. */
+void adjust_params(struct synth_t *p, enum command_t cmd, enum adjust_t adj,
+                   int value)
+{
+	switch (cmd) {
+	case CMD_SET_FREQUENCY:
+		p->frequency = adjust_value(p->frequency, value, adj);
+		break;
+	case CMD_SET_PITCH:
+		p->pitch = adjust_value(p->pitch, value, adj);
+		break;
+	case CMD_SET_RANGE:
+		p->range = adjust_value(p->range, value, adj);
+		break;
+	case CMD_SET_PUNCTUATION:
+		p->punct = adjust_value(p->punct, value, adj);
+		break;
+	case CMD_SET_RATE:
+		p->rate = adjust_value(p->rate, value, adj);
+		break;
+	case CMD_SET_VOLUME:
+		p->volume = adjust_value(p->volume, value, adj);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Lookahead state while handing texts over to the workers. */
+struct lookahead_t {
+	struct synth_t params;
+	int scanned;
+};
+
+static int dispatch_entry(void *data, void *arg)
+{
+	struct espeak_entry_t *entry = data;
+	struct lookahead_t *la = arg;
+	struct synth_t *p = &la->params;
+	char key[maxCachedText + 128];
+	int key_len;
+
+	if (++la->scanned > maxLookahead)
+		return 1;
+	switch (entry->cmd) {
+	case CMD_SET_FREQUENCY:
+	case CMD_SET_PITCH:
+	case CMD_SET_RANGE:
+	case CMD_SET_PUNCTUATION:
+	case CMD_SET_RATE:
+	case CMD_SET_VOLUME:
+		adjust_params(p, entry->cmd, entry->adjust, entry->value);
+		break;
+	case CMD_PAUSE:
+		return 1;
+	case CMD_SPEAK_TEXT:
+		if (entry->job >= 0)
+			break;
+		if (pcm_cache && entry->len <= maxCachedText) {
+			p->buf = entry->buf;
+			p->len = entry->len;
+			key_len = cache_key(p, key, sizeof(key));
+			if (key_len && pcm_cache_contains(pcm_cache, key, key_len))
+				// It will be replayed from the cache.
+				break;
+		}
+		entry->job = pool_submit(p, entry->buf, entry->len);
+		if (entry->job < 0)
+			// All the workers are busy.
+			return 1;
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+/* Hand the texts coming up in the queue over to the synthesis workers,
+ * along with the parameters they are to be spoken with.  Called with
+ * queue_guard held. */
+static void dispatch_ahead(struct synth_t *s)
+{
+	struct lookahead_t la;
+
+	la.params = *s;
+	la.scanned = 0;
+	queue_foreach(synth_queue, dispatch_entry, &la);
 }
 
 static void free_espeak_entry(struct espeak_entry_t *entry)
 {
 	assert(entry);
-	if (entry->cmd == CMD_SPEAK_TEXT)
+	stats_add(STATS_ESPEAK, STAT_ENTRIES_DONE, 1);
+	if (entry->cmd == CMD_SPEAK_TEXT) {
+		stats_add(STATS_ESPEAK, STAT_TEXT_DONE, entry->len);
+		stats_claim_thread(STATS_ESPEAK);
+		if (entry->job >= 0)
+			pool_release(entry->job);
 		free(entry->buf);
+	}
 	free(entry);
 }
 
-static void synth_queue_clear()
+// Returns how many entries were dropped.
+static int synth_queue_clear()
 {
 	struct espeak_entry_t *current;
+	int n = 0;
 
 	while (queue_peek(synth_queue)) {
 		current = (struct espeak_entry_t *) queue_remove(synth_queue);
 		free_espeak_entry(current);
+		n++;
 	}
+	return n;
 }
 
 static int reinitialize_espeak(struct synth_t *s)
@@ -350,11 +1052,13 @@ static int reinitialize_espeak(struct synth_t *s)
 	int rate;
 
 	/* Re-initialize espeak */
-	rate = espeak_Initialize(AUDIO_OUTPUT_PLAYBACK, 0, NULL, 0);
+	rate = espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, bufferLength, NULL, 0);
 	if (rate < 0) {
 		fprintf(stderr, "Unable to initialize espeak.\n");
 		return -1;
 	}
+	sample_rate = rate;
+	audio_open(rate);
 
 	espeak_SetSynthCallback(callback);
 
@@ -365,21 +1069,64 @@ static int reinitialize_espeak(struct synth_t *s)
 	espeak_SetParameter(espeakRATE, s->rate * rateMultiplier + rateOffset, 0);
 	espeak_SetParameter(espeakVOLUME, (s->volume + 1) * volumeMultiplier, 0);
 	espeak_SetParameter(espeakCAPITALS, 0, 0);
+	set_punctuation(s, s->punct, ADJ_SET);
 	paused_espeak = 0;
 	return 0;
 }
 
-/* Wait for up to a second before retrying an entry which could not be
- * processed, so that we do not busy-loop on a persistent error.  Called
- * and returns with queue_guard held.  Wakes up immediately if a stop is
- * requested. */
+/* Called when the audio output stopped playing altogether.  The audio
+ * espeak produced meanwhile does not count as progress then: it can only
+ * pile up, and restarting is what may help. */
+void espeak_output_stalled(void)
+{
+	atomic_store(&synth_progressed, 0);
+}
+
+/* Called by the playback thread when it played something: wake up the
+ * espeak thread if it is waiting before a retry. */
+void espeak_output_progressed(void)
+{
+	// Pairs with the fence in espeak_wait_retry.
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load(&retry_waiting))
+		return;
+	pthread_mutex_lock(&queue_guard);
+	pthread_cond_signal(&wake_stop);
+	pthread_mutex_unlock(&queue_guard);
+}
+
+/* Wait before retrying an entry which could not be processed, so that we
+ * do not busy-loop on a persistent error.  Called and returns with
+ * queue_guard held.  Wakes up immediately if a stop is requested, or when
+ * audio gets played. */
 static void espeak_wait_retry(void)
 {
 	struct timespec timeout;
+	long long max_delay = stallTimeout * 1000000LL / 10;
 
 	clock_gettime(CLOCK_MONOTONIC, &timeout);
-	timeout.tv_sec++;
-	pthread_cond_timedwait(&wake_stop, &queue_guard, &timeout);
+	timeout.tv_sec += retry_delay / 1000000000LL;
+	timeout.tv_nsec += retry_delay % 1000000000LL;
+	if (timeout.tv_nsec >= 1000000000L) {
+		timeout.tv_sec++;
+		timeout.tv_nsec -= 1000000000L;
+	}
+	retry_delay *= 2;
+	if (retry_delay > max_delay)
+		retry_delay = max_delay;
+
+	atomic_store(&retry_waiting, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!stop_requested && should_run)
+		pthread_cond_timedwait(&wake_stop, &queue_guard, &timeout);
+	atomic_store(&retry_waiting, 0);
+}
+
+// Publish the state of the wedge detection.
+static void update_failure_stats(void)
+{
+	stats_set(STATS_ESPEAK, STAT_STALLED_RETRIES, stalled_retries);
+	stats_set(STATS_ESPEAK, STAT_RESTART_ATTEMPTS, restart_attempts);
 }
 
 /* Handle an entry which could not be processed.  Called and returns
@@ -390,12 +1137,17 @@ static void espeak_wait_retry(void)
  * either, exit so that the init system respawns us in a clean state. */
 static void espeak_handle_failure(struct synth_t *s)
 {
+	long long now = monotonic_ns();
+
 	if (atomic_exchange(&synth_progressed, 0)) {
 		/* Espeak is making progress, it is merely backlogged. */
 		stalled_retries = 0;
-	} else if (++stalled_retries >= ESPEAK_STALL_RETRIES) {
+	} else if (!stalled_retries++) {
+		stalled_since = now;
+	} else if (now - stalled_since >= stallTimeout * 1000000LL) {
 		stalled_retries = 0;
-		if (++restart_attempts > ESPEAK_MAX_RESTARTS) {
+		retry_delay = RETRY_MIN_NS;
+		if (++restart_attempts > maxRestarts) {
 			fprintf(stderr, "espeakup: espeak keeps failing without "
 			        "making progress and restarting it did not help, "
 			        "aborting\n");
@@ -403,25 +1155,31 @@ static void espeak_handle_failure(struct synth_t *s)
 			 * while the audio device is wedged. */
 			_exit(3);
 		}
+		stats_add(STATS_ESPEAK, STAT_ENGINE_RESTARTS, 1);
+		PROBE1(restart, restart_attempts);
 		fprintf(stderr, "espeakup: espeak has been failing without "
-		        "making progress for %d seconds, restarting it\n",
-		        ESPEAK_STALL_RETRIES);
+		        "making progress for %d ms, restarting it\n", stallTimeout);
 		/* Call into espeak with queue_guard released: these calls can
 		 * take time, or block on a wedged audio device.  If they do
 		 * block forever, the stop-acknowledgement timeout in the
-		 * softsynth thread is our last resort. */
+		 * softsynth thread, or the watchdog, is our last resort. */
 		pthread_mutex_unlock(&queue_guard);
+		watchdog_busy(1);
 		if (!paused_espeak) {
 			espeak_Cancel();
 			espeak_Terminate();
+			audio_close_now();
 			paused_espeak = 1;
 		}
 		reinitialize_espeak(s);
+		watchdog_busy(0);
 		clock_gettime(CLOCK_MONOTONIC, &last_restart);
 		pthread_mutex_lock(&queue_guard);
+		update_failure_stats();
 		return;
 	}
 
+	update_failure_stats();
 	espeak_wait_retry();
 }
 
@@ -435,8 +1193,14 @@ static void queue_process_entry(struct synth_t *s)
 		if (current)
 			free_espeak_entry(current);
 		current = queue_peek(synth_queue);
+		entry_id = current->id;
+		PROBE3(dequeue, current->id, current->cmd,
+		       current->cmd == CMD_SPEAK_TEXT ? current->len : 0);
 	}
+	if (pool_size())
+		dispatch_ahead(s);
 	pthread_mutex_unlock(&queue_guard);
+	watchdog_busy(1);
 
 	if (current->cmd != CMD_PAUSE && paused_espeak) {
 		if (reinitialize_espeak(s) < 0) {
@@ -444,6 +1208,7 @@ static void queue_process_entry(struct synth_t *s)
 			 * Calling espeak functions on a terminated engine would
 			 * just fail (or worse).  Leave the entry queued and retry
 			 * after a small pause. */
+			watchdog_busy(0);
 			pthread_mutex_lock(&queue_guard);
 			espeak_handle_failure(s);
 			return;
@@ -457,8 +1222,7 @@ static void queue_process_entry(struct synth_t *s)
 	case CMD_SET_MARK:
 		snprintf(markbuff, sizeof(markbuff), "<mark name=\"%d\"/>",
 		         current->value);
-		error = espeak_Synth(markbuff, strlen(markbuff) + 1, 0, POS_CHARACTER,
-		                     0, espeakSSML, NULL, NULL);
+		error = synth(markbuff, strlen(markbuff) + 1, espeakSSML);
 		break;
 	case CMD_SET_PITCH:
 		error = set_pitch(s, current->value, current->adjust);
@@ -481,15 +1245,17 @@ static void queue_process_entry(struct synth_t *s)
 	case CMD_SPEAK_TEXT:
 		s->buf = current->buf;
 		s->len = current->len;
-		error = speak_text(s);
+		error = speak_text(s, &current->job);
 		break;
 	case CMD_PAUSE:
 		if (!paused_espeak) {
 			error = espeak_Cancel();
 			if (error == EE_OK)
 				error = espeak_Terminate();
-			if (error == EE_OK)
+			if (error == EE_OK) {
+				audio_close();
 				paused_espeak = 1;
+			}
 		} else {
 			error = EE_OK;
 		}
@@ -500,6 +1266,9 @@ static void queue_process_entry(struct synth_t *s)
 		break;
 	}
 
+	watchdog_busy(0);
+	if (error == EE_OK)
+		engine_done(current, s);
 	pthread_mutex_lock(&queue_guard);
 	if (error == EE_OK) {
 		/* Processed, drop it */
@@ -508,6 +1277,7 @@ static void queue_process_entry(struct synth_t *s)
 		free_espeak_entry(current);
 		current = NULL;
 		stalled_retries = 0;
+		retry_delay = RETRY_MIN_NS;
 		if (restart_attempts) {
 			/* Forget about past restarts once the engine has been
 			 * healthy for a while.  Entries can spuriously succeed
@@ -516,11 +1286,14 @@ static void queue_process_entry(struct synth_t *s)
 			 * quick success must not reset the counter. */
 			struct timespec now;
 			clock_gettime(CLOCK_MONOTONIC, &now);
-			if (now.tv_sec - last_restart.tv_sec >= ESPEAK_HEALTHY_SECS)
+			if (now.tv_sec - last_restart.tv_sec >= healthyTime)
 				restart_attempts = 0;
 		}
+		update_failure_stats();
 	} else {
-		if (error != EE_BUFFER_FULL)
+		if (error == EE_BUFFER_FULL)
+			stats_add(STATS_ESPEAK, STAT_BUFFER_FULL, 1);
+		else
 			fprintf(stderr, "espeak error: %d\n", error);
 		/* The entry stays queued and will be retried.  Give espeak a
 		 * little break before that, whatever the error: previously only
@@ -530,24 +1303,49 @@ static void queue_process_entry(struct synth_t *s)
 	}
 }
 
+/* (Re)create the audio cache, with the configured sizes. */
+static void setup_cache(void)
+{
+	if (pcm_cache) {
+		free_pcm_cache(pcm_cache);
+		free(capture.samples);
+		pcm_cache = NULL;
+		capture.samples = NULL;
+	}
+	if (cacheSize > 0) {
+		pcm_cache = new_pcm_cache((size_t) cacheSize * 1024,
+		                          (size_t) cacheEntrySize * 1024);
+		capture.size = pcm_cache_max_entry_bytes(pcm_cache) / sizeof(short);
+		capture.samples = allocMem(capture.size * sizeof(short));
+	}
+}
+
 int initialize_espeak(struct synth_t *s)
 {
 	int rate;
 
 	/* initialize espeak */
-	rate = espeak_Initialize(AUDIO_OUTPUT_PLAYBACK, 0, NULL, 0);
+	rate = espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, bufferLength, NULL, 0);
 	if (rate < 0) {
 		fprintf(stderr, "Unable to initialize espeak.\n");
 		return -1;
 	}
+	sample_rate = rate;
+	/* The audio device itself is opened by the playback thread, when
+	 * there is something to play. */
+	audio_open(rate);
+	trim_init(&trim, trimThreshold, trimMaxPause * rate / 1000);
+	if (rateBoost > 1.0)
+		stretch = new_stretch(rate);
 
 	espeak_SetSynthCallback(callback);
 
+	setup_cache();
+
 	/* Setup initial voice parameters */
 	if (defaultVoice && defaultVoice[0]) {
 		set_voice(s, defaultVoice);
-		free(defaultVoice);
-		defaultVoice = NULL;
+		snprintf(appliedVoice, sizeof(appliedVoice), "%s", defaultVoice);
 	}
 	set_frequency(s, defaultFrequency, ADJ_SET);
 	set_pitch(s, defaultPitch, ADJ_SET);
@@ -559,6 +1357,97 @@ int initialize_espeak(struct synth_t *s)
 	return 0;
 }
 
+/* Apply a new configuration in place, between two entries: the engine
+ * keeps running, and the softsynth device stays open.  Default voice
+ * parameters which changed replace the current ones, the others are
+ * applied again with the new multipliers. */
+static void reload_configuration(struct synth_t *s)
+{
+	int frequency = defaultFrequency;
+	int pitch = defaultPitch;
+	int range = defaultRange;
+	int rate = defaultRate;
+	int volume = defaultVolume;
+	int cache_size = cacheSize;
+	int cache_entry_size = cacheEntrySize;
+	int voice_changed = 0;
+
+	reload_options();
+	pool_signal(SIGHUP);
+
+	if (defaultFrequency != frequency)
+		s->frequency = defaultFrequency;
+	if (defaultPitch != pitch)
+		s->pitch = defaultPitch;
+	if (defaultRange != range)
+		s->range = defaultRange;
+	if (defaultRate != rate)
+		s->rate = defaultRate;
+	if (defaultVolume != volume)
+		s->volume = defaultVolume;
+	/* The voice picked through Speakup stays, unless the default one
+	 * was changed. */
+	if (defaultVoice && defaultVoice[0] &&
+	    strcmp(defaultVoice, appliedVoice)) {
+		snprintf(appliedVoice, sizeof(appliedVoice), "%s", defaultVoice);
+		voice_changed = 1;
+	}
+	if (paused_espeak) {
+		// reinitialize_espeak applies them.
+		if (voice_changed)
+			snprintf(s->voice, sizeof(s->voice), "%s", defaultVoice);
+	} else {
+		if (voice_changed)
+			set_voice(s, defaultVoice);
+		set_frequency(s, s->frequency, ADJ_SET);
+		set_pitch(s, s->pitch, ADJ_SET);
+		set_range(s, s->range, ADJ_SET);
+		set_rate(s, s->rate, ADJ_SET);
+		set_volume(s, s->volume, ADJ_SET);
+	}
+
+	trim_init(&trim, trimThreshold, trimMaxPause * sample_rate / 1000);
+	/* The cached audio may not sound as the new configuration would. */
+	if (cacheSize != cache_size || cacheEntrySize != cache_entry_size)
+		setup_cache();
+	else if (pcm_cache)
+		pcm_cache_clear(pcm_cache);
+	engine_params(s);
+	if (debug)
+		printf("Configuration reloaded\n");
+}
+
+/* Nothing came in for idleTimeout: release what we can until something
+ * does.  Called and returns with queue_guard held. */
+static void enter_idle(void)
+{
+	idle = 1;
+	stats_add(STATS_ESPEAK, STAT_IDLE_PERIODS, 1);
+	pthread_mutex_unlock(&queue_guard);
+	if (!paused_espeak) {
+		// The device is closed once everything queued has been played.
+		audio_close();
+		if (idleSuspend && espeak_Terminate() == EE_OK)
+			paused_espeak = 1;
+	}
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+	if (debug)
+		printf("Idle%s\n", paused_espeak ? ", espeak suspended" : "");
+	pthread_mutex_lock(&queue_guard);
+}
+
+/* Input came in while idle.  A suspended engine is started again when
+ * processing it, as after a pause. */
+static void leave_idle(void)
+{
+	idle = 0;
+	audio_wakeup();
+	if (!paused_espeak)
+		audio_open(sample_rate);
+}
+
 /* espeak_thread is the "main" function of our secondary (queue-processing)
  * thread.
  * First, lock queue_guard, because it needs to be locked when we call
@@ -582,10 +1471,35 @@ void *espeak_thread(void *arg)
 {
 	struct synth_t *s = (struct synth_t *) arg;
 
+	struct timespec idle_deadline;
+	int dropped;
+	int err = 0;
+
+	prefault_stack();
 	pthread_mutex_lock(&queue_guard);
 	while (should_run) {
-		while (should_run && !queue_peek(synth_queue) && !stop_requested)
-			pthread_cond_wait(&runner_awake, &queue_guard);
+		clock_gettime(CLOCK_MONOTONIC, &idle_deadline);
+		idle_deadline.tv_sec += idleTimeout;
+		while (should_run && !queue_peek(synth_queue) && !stop_requested &&
+		       !reload_requested) {
+			if (idleTimeout && !idle && err == ETIMEDOUT)
+				enter_idle();
+			else if (idleTimeout && !idle)
+				err = pthread_cond_timedwait(&runner_awake, &queue_guard,
+				                             &idle_deadline);
+			else
+				pthread_cond_wait(&runner_awake, &queue_guard);
+		}
+		err = 0;
+		if (idle && queue_peek(synth_queue))
+			leave_idle();
+
+		if (reload_requested) {
+			reload_requested = 0;
+			pthread_mutex_unlock(&queue_guard);
+			reload_configuration(s);
+			pthread_mutex_lock(&queue_guard);
+		}
 
 		if (stop_requested) {
 			current = NULL;
@@ -597,18 +1511,43 @@ void *espeak_thread(void *arg)
 			 * softsynth thread) is blocked waiting for stop_acknowledged
 			 * as long as stop_requested is set. */
 			pthread_mutex_unlock(&queue_guard);
-			stop_speech();
+			count_wasted_synthesis();
+			watchdog_busy(1);
+			// Not into a terminated engine, while paused or idle.
+			if (paused_espeak)
+				audio_stop();
+			else
+				stop_speech();
+			watchdog_busy(0);
 			pthread_mutex_lock(&queue_guard);
-			synth_queue_clear();
+			dropped = synth_queue_clear();
+			PROBE1(flush_ack, dropped);
 			stop_requested = 0;
 			pthread_cond_signal(&stop_acknowledged);
 		}
 
-		while (should_run && queue_peek(synth_queue) && !stop_requested) {
+		while (should_run && queue_peek(synth_queue) && !stop_requested &&
+		       !reload_requested) {
 			queue_process_entry(s);
 		}
 	}
 	pthread_cond_signal(&stop_acknowledged);
 	pthread_mutex_unlock(&queue_guard);
+
+	if (debug && pcm_cache) {
+		struct pcm_cache_stats_t st;
+		pcm_cache_get_stats(pcm_cache, &st);
+		printf("PCM cache: %lu hits, %lu misses, %lu insertions, "
+		       "%lu evictions, %zu entries, %zu bytes\n", st.hits, st.misses,
+		       st.insertions, st.evictions, st.entries, st.bytes);
+	}
+	if (debug) {
+		print_duration_stats("Synth callback interval", &callback_interval);
+		print_duration_stats("Synth callback audio", &callback_audio);
+		if (trimThreshold)
+			printf("Silence trimmed: %ld ms\n",
+			       trim.trimmed * 1000 / sample_rate);
+		print_thread_stats("Synthesis");
+	}
 	return NULL;
 }
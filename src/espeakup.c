@@ -17,6 +17,8 @@
  *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -27,7 +29,12 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "engine.h"
 #include "espeakup.h"
+#include "pool.h"
+#include "realtime.h"
+#include "stats.h"
+#include "watchdog.h"
 
 // path to our pid file
 char *pidPath = "/var/run/espeakup.pid";
@@ -40,8 +47,8 @@ int self_pipe_fds[2];
 volatile int should_run = 1;
 espeak_AUDIO_OUTPUT audio_mode;
 
-pthread_cond_t runner_awake = PTHREAD_COND_INITIALIZER;
 /* Initialized in main: use the monotonic clock for timed waits. */
+pthread_cond_t runner_awake;
 pthread_cond_t wake_stop;
 pthread_cond_t stop_acknowledged;
 pthread_mutex_t queue_guard = PTHREAD_MUTEX_INITIALIZER;
@@ -52,7 +59,7 @@ int espeakup_start_daemon(void)
 	pid_t pid;
 	char c;
 
-	if (pipe(fds) < 0) {
+	if (pipe2(fds, O_CLOEXEC) < 0) {
 		perror("pipe");
 		exit(1);
 	}
@@ -94,7 +101,7 @@ int espeakup_is_running(void)
 	char s[16];
 	pid_t pid;
 
-	pidFile = open(pidPath, O_RDWR | O_CREAT, 0666);
+	pidFile = open(pidPath, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
 	if (pidFile < 0) {
 		printf("Can not work with the pid file %s: %s\n", pidPath,
 		       strerror(errno));
@@ -137,18 +144,125 @@ error:
 	return -1;
 }
 
-int main(int argc, char **argv)
+/* Run espeakup proper, in the main process, or in each engine process
+ * under a supervisor.  Reports the startup status on fd, if any. */
+static int run(int fd, int watchdog)
 {
-	int fd, devnull;
 	char ret = 0;
 	sigset_t sigset;
 	int err;
 	pthread_t signal_thread_id;
 	pthread_t espeak_thread_id;
 	pthread_t softsynth_thread_id;
+	pthread_t audio_thread_id;
+	pthread_t stats_thread_id;
+	pthread_t watchdog_thread_id;
 	struct synth_t s = {
 		.voice = "",
 	};
+
+	/* Fork the synthesis workers, if any, while we are still
+	 * single-threaded. */
+	if (start_synthesis_workers() < 0)
+		fprintf(stderr, "Unable to start the synthesis workers, "
+		        "synthesizing in the main process only.\n");
+
+	// Lock memory and pin to CPUs, if requested.
+	setup_realtime();
+
+	// create the signal processing thread here.
+	err = create_thread(&signal_thread_id, signal_thread, NULL, 0);
+	if (err != 0)
+		return 4;
+
+	/*
+	 * Set up the signal mask which will be the default for all threads.
+	 * We are handling sigint, sigterm and sighup, so block them.
+	 */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGINT);
+	sigaddset(&sigset, SIGTERM);
+	sigaddset(&sigset, SIGHUP);
+	sigprocmask(SIG_BLOCK, &sigset, NULL);
+
+	// Initialize espeak
+	if (initialize_espeak(&s) < 0)
+		return 2;
+	engine_params(&s);
+
+	// Spawn the playback thread, real-time if requested.
+	err = create_thread(&audio_thread_id, audio_thread, NULL,
+	                    realtimePriority);
+	if (err != 0)
+		return 4;
+
+	// open the softsynth
+	if (open_softsynth() < 0)
+		return 2;
+
+	// Spawn our softsynth thread.
+	err = create_thread(&softsynth_thread_id, softsynth_thread, &s, 0);
+	if (err != 0)
+		return 4;
+
+	/* Spawn our espeak-interacting thread.  In real-time mode it runs
+	 * just below the playback thread, so that synthesis keeps up. */
+	err = create_thread(&espeak_thread_id, espeak_thread, &s,
+	                    realtimePriority > 1 ? realtimePriority - 1
+	                                         : realtimePriority);
+	if (err != 0)
+		return 4;
+
+	// Serve live statistics, if requested.
+	if (stats_enabled()) {
+		err = create_thread(&stats_thread_id, stats_thread, NULL, 0);
+		if (err != 0)
+			return 4;
+	}
+
+	// Send heartbeats to the systemd watchdog, if enabled.
+	if (watchdog) {
+		err = create_thread(&watchdog_thread_id, watchdog_thread, NULL, 0);
+		if (err != 0)
+			return 4;
+	}
+
+	if (fd >= 0)
+		(void) write(fd, &ret, 1);
+
+	// wait for the threads to shut down.
+	pthread_join(signal_thread_id, NULL);
+	pthread_join(softsynth_thread_id, NULL);
+	pthread_join(espeak_thread_id, NULL);
+	audio_shutdown();
+	pthread_join(audio_thread_id, NULL);
+	if (stats_enabled())
+		pthread_join(stats_thread_id, NULL);
+	if (watchdog)
+		pthread_join(watchdog_thread_id, NULL);
+
+	if (!paused_espeak)
+		espeak_Terminate();
+	close_softsynth();
+	pool_stop();
+	return ret;
+}
+
+/* An engine process: the supervisor reports the status, has the watchdog,
+ * and serves the statistics. */
+static int run_engine(void)
+{
+	statsSocket = NULL;
+	statsFile = NULL;
+	return run(-1, 0);
+}
+
+int main(int argc, char **argv)
+{
+	int fd = -1;
+	int devnull;
+	char ret = 0;
+	int watchdog;
 	pthread_condattr_t monotonic_attr;
 
 	/* Condition variables used with pthread_cond_timedwait must use the
@@ -157,6 +271,7 @@ int main(int argc, char **argv)
 	 * too early or far too late. */
 	pthread_condattr_init(&monotonic_attr);
 	pthread_condattr_setclock(&monotonic_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&runner_awake, &monotonic_attr);
 	pthread_cond_init(&wake_stop, &monotonic_attr);
 	pthread_cond_init(&stop_acknowledged, &monotonic_attr);
 	pthread_condattr_destroy(&monotonic_attr);
@@ -169,7 +284,7 @@ int main(int argc, char **argv)
 	}
 
 	// set up the pipe used to wake the espeak thread
-	if (pipe(self_pipe_fds) < 0) {
+	if (pipe2(self_pipe_fds, O_CLOEXEC) < 0) {
 		perror("Unable to create pipe");
 		return 5;
 	}
@@ -177,6 +292,18 @@ int main(int argc, char **argv)
 	// process command line options
 	process_cli(argc, argv);
 
+	// Compile the substitution dictionary, if any.
+	if (load_substitutions() < 0)
+		return 1;
+
+	if (renderMode)
+		return render();
+	if (engine_process())
+		return run_engine();
+
+	// Before forking, while we are the process systemd watches.
+	watchdog = watchdog_init();
+
 	if (!debug && espeakup_mode == ESPEAKUP_MODE_SPEAKUP) {
 		fd = espeakup_start_daemon();
 
@@ -194,62 +321,13 @@ int main(int argc, char **argv)
 			close(devnull);
 	}
 
-	// create the signal processing thread here.
-	err = pthread_create(&signal_thread_id, NULL, signal_thread, NULL);
-	if (err != 0) {
-		ret = 4;
-		goto out;
-	}
-
-	/*
-	 * Set up the signal mask which will be the default for all threads.
-	 * We are handling sigint and sigterm, so block them.
-	 */
-	sigemptyset(&sigset);
-	sigaddset(&sigset, SIGINT);
-	sigaddset(&sigset, SIGTERM);
-	sigprocmask(SIG_BLOCK, &sigset, NULL);
-
-	// Initialize espeak
-	if (initialize_espeak(&s) < 0) {
-		ret = 2;
-		goto out;
-	}
-
-	// open the softsynth
-	if (open_softsynth() < 0) {
-		ret = 2;
-		goto out;
-	}
-
-	// Spawn our softsynth thread.
-	err = pthread_create(&softsynth_thread_id, NULL, softsynth_thread, &s);
-	if (err != 0) {
-		ret = 4;
-		goto out;
-	}
-
-	// Spawn our espeak-interacting thread.
-	err = pthread_create(&espeak_thread_id, NULL, espeak_thread, &s);
-	if (err != 0) {
-		ret = 4;
-		goto out;
-	}
-
-	if (!debug && espeakup_mode == ESPEAKUP_MODE_SPEAKUP)
-		(void) write(fd, &ret, 1);
-
-	// wait for the threads to shut down.
-	pthread_join(signal_thread_id, NULL);
-	pthread_join(softsynth_thread_id, NULL);
-	pthread_join(espeak_thread_id, NULL);
-
-	if (!paused_espeak)
-		espeak_Terminate();
-	close_softsynth();
+	if (standbyTimeout)
+		ret = supervise(fd, watchdog);
+	else
+		ret = run(fd, watchdog);
 
 out:
-	if (!debug && espeakup_mode == ESPEAKUP_MODE_SPEAKUP) {
+	if (fd >= 0) {
 		if (ret != 1)
 			unlink(pidPath);
 		if (ret != 0)
@@ -23,6 +23,7 @@
 // This was added for gcc 4.3
 #include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include <espeak-ng/speak_lib.h>
 
@@ -65,8 +66,13 @@ struct espeak_entry_t {
 	int value;
 	char *buf;
 	int len;
+	int job;     // synthesis worker job rendering the text, or -1
+	unsigned long id;  // for the probes
 };
 
+struct parser_t;
+struct parser_callbacks_t;
+
 struct synth_t {
 	int frequency;
 	int pitch;
@@ -82,18 +88,48 @@ struct synth_t {
 extern struct queue_t *synth_queue;
 extern int debug;
 extern enum espeakup_mode_t espeakup_mode;
+extern int renderMode;
 
 extern void process_cli(int argc, char **argv);
+extern void reload_options(void);
+extern char **restart_arguments(const char *extra);
 extern void *signal_thread(void *arg);
 extern int initialize_espeak(struct synth_t *s);
+extern int start_synthesis_workers(void);
 extern void *espeak_thread(void *arg);
+extern void espeak_output_progressed(void);
+extern void espeak_output_stalled(void);
+extern void adjust_params(struct synth_t *p, enum command_t cmd,
+                          enum adjust_t adj, int value);
+extern int load_substitutions(void);
+extern struct parser_t *new_speech_parser(const struct parser_callbacks_t *cb,
+                                          void *data);
+extern void reload_speech_parser(struct parser_t *parser);
 extern int open_softsynth(void);
 extern void close_softsynth(void);
 extern void *softsynth_thread(void *arg);
 extern void softsynth_reportindex(int index);
+extern void softsynth_writeindex(int index);
+extern int audio_open(int rate);
+extern void audio_close(void);
+extern void audio_close_now(void);
+extern int audio_write(const short *samples, int count);
+extern int audio_mark(int value);
+extern void audio_stop(void);
+extern void audio_stop_requested(void);
+extern void audio_wakeup(void);
+extern uint64_t audio_queued_pos(void);
+extern uint64_t audio_played_pos(void);
+extern void audio_shutdown(void);
+extern void *audio_thread(void *arg);
+extern int render(void);
 extern volatile int should_run;
 extern volatile int stop_requested;
+extern volatile int reload_requested;
+extern volatile int reload_substitutions;
 extern int paused_espeak;
+extern int stallTimeout;
+extern int standbyTimeout;
 extern int self_pipe_fds[2];
 #define PIPE_READ_FD (self_pipe_fds[0])
 #define PIPE_WRITE_FD (self_pipe_fds[1])
@@ -0,0 +1,432 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Parser of the softsynth protocol: text, with commands introduced by
+ * \x01, and \x18 to flush.  It only calls back with what it finds, so that
+ * it can be exercised without a speakup device.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parser.h"
+#include "stringhandling.h"
+#include "substitute.h"
+
+// synth flush character
+static const int synthFlushChar = 0x18;
+
+/* The parser is resumable: speakup does not care about read boundaries,
+ * so a control sequence or a multibyte UTF-8 character can be split
+ * across two reads from the softsynth device.  Whatever is left
+ * incomplete at the end of a buffer is kept here and completed with the
+ * next one. */
+enum parse_state_t
+{
+	PARSE_TEXT,
+	PARSE_CMD,           // got the command introducer
+	PARSE_CMD_VALUE,     // got the adjustment sign, and maybe some digits
+};
+
+struct parser_t {
+	enum espeakup_mode_t mode;
+	const struct parser_callbacks_t *cb;
+	void *data;
+	enum parse_state_t state;
+	enum adjust_t adj;
+	int value;
+	char partial[4];     // incomplete UTF-8 character
+	int partial_len;
+	char *text;          // acsint mode: text accumulated up to end of line
+	int text_l;
+	struct substitutions_t *substitutions;
+};
+
+struct parser_t *new_parser(enum espeakup_mode_t mode,
+                            const struct parser_callbacks_t *cb, void *data)
+{
+	struct parser_t *p = allocMem(sizeof(struct parser_t));
+
+	memset(p, 0, sizeof(struct parser_t));
+	p->mode = mode;
+	p->cb = cb;
+	p->data = data;
+	p->state = PARSE_TEXT;
+	p->text = initString(&p->text_l);
+	return p;
+}
+
+void free_parser(struct parser_t *p)
+{
+	if (p->text != EMPTYSTRING)
+		free(p->text);
+	free(p);
+}
+
+/* Apply a substitution dictionary to the text, or none if d is NULL.  In
+ * acsint mode, the text is SSML which the client is in control of, and it
+ * is left alone. */
+void parser_set_substitutions(struct parser_t *p, struct substitutions_t *d)
+{
+	p->substitutions = d;
+}
+
+static void parser_reset(struct parser_t *p)
+{
+	p->state = PARSE_TEXT;
+	p->partial_len = 0;
+}
+
+/* Long texts are split at sentence or clause boundaries before being
+ * queued, so that speech starts sooner and a flush throws less away:
+ * the first chunk of a text is kept small to start speaking quickly,
+ * the following ones are larger for throughput.  Chunks shorter than
+ * minChunkSize are not split off, so that a lone word is never spelled. */
+static const size_t firstChunkSize = 100;
+static const size_t chunkSize = 1024;
+static const size_t minChunkSize = 20;
+
+/* Find where to end the first chunk of txt: after a sentence if
+ * possible, else after a clause, else after a word.  The chunk is
+ * limited to limit bytes, and at least minChunkSize bytes are left for
+ * the rest.  In acsint mode, the text is SSML, so it is only cut outside
+ * markup. */
+static size_t chunk_boundary(struct parser_t *p, const char *txt,
+                             size_t length, size_t limit)
+{
+	size_t sentence = 0, clause = 0, word = 0;
+	size_t i, end;
+	int ssml = p->mode == ESPEAKUP_MODE_ACSINT;
+	int in_tag = 0, in_entity = 0, depth = 0;
+
+	end = length - minChunkSize;
+	if (end > limit)
+		end = limit;
+	for (i = 0; i < end; i++) {
+		char c = txt[i];
+		if (ssml) {
+			if (in_tag) {
+				if (c == '>') {
+					in_tag = 0;
+					if (txt[i - 1] == '/')
+						depth--;     // empty element
+				}
+				continue;
+			}
+			if (c == '<') {
+				in_tag = 1;
+				if (txt[i + 1] == '/')
+					depth--;
+				else if (txt[i + 1] != '?' && txt[i + 1] != '!')
+					depth++;
+				continue;
+			}
+			if (in_entity) {
+				if (c == ';')
+					in_entity = 0;
+				continue;
+			}
+			if (c == '&') {
+				in_entity = 1;
+				continue;
+			}
+			if (depth > 0)
+				continue;
+		}
+		if (i < minChunkSize || !isspace((unsigned char) txt[i + 1]))
+			continue;
+		// Cut after the space.
+		if (c == '.' || c == '!' || c == '?')
+			sentence = i + 2;
+		else if (c == ',' || c == ';' || c == ':')
+			clause = i + 2;
+		else if (!isspace((unsigned char) c))
+			word = i + 2;
+	}
+	if (sentence)
+		return sentence;
+	if (clause)
+		return clause;
+	return word;
+}
+
+static void add_chunked_text(struct parser_t *p, const char *txt,
+                             size_t length)
+{
+	size_t limit = firstChunkSize;
+	size_t cut;
+
+	while (length > limit + minChunkSize) {
+		cut = chunk_boundary(p, txt, length, limit);
+		if (!cut)
+			// No sensible place to cut, keep it whole.
+			break;
+		p->cb->text(p->data, txt, cut);
+		txt += cut;
+		length -= cut;
+		limit = chunkSize;
+	}
+	p->cb->text(p->data, txt, length);
+}
+
+static void add_text(struct parser_t *p, const char *txt, size_t length)
+{
+	char *out;
+	int out_l;
+
+	if (p->substitutions) {
+		out = initString(&out_l);
+		if (substitute(p->substitutions, txt, length, &out, &out_l)) {
+			if (out_l)
+				add_chunked_text(p, out, out_l);
+			free(out);
+			return;
+		}
+	}
+	add_chunked_text(p, txt, length);
+}
+
+static int is_text(char c)
+{
+	return c < 0 || c >= ' ' || c == '\n';
+}
+
+/* Return the length of a UTF-8 character cut by the end of buf, or 0 if
+ * buf ends with a complete character. */
+static int utf8_incomplete_tail(const char *buf, size_t length)
+{
+	size_t i;
+	int need;
+
+	for (i = 1; i <= 3 && i <= length; i++) {
+		unsigned char c = buf[length - i];
+		if ((c & 0xc0) == 0x80)
+			continue;     // continuation byte, look for the lead byte
+		if ((c & 0xe0) == 0xc0)
+			need = 2;
+		else if ((c & 0xf0) == 0xe0)
+			need = 3;
+		else if ((c & 0xf8) == 0xf0)
+			need = 4;
+		else
+			return 0;
+		return (int) i < need ? (int) i : 0;
+	}
+	return 0;
+}
+
+// Hand over the text accumulated in acsint mode.
+static void flush_text(struct parser_t *p)
+{
+	add_chunked_text(p, p->text, p->text_l);
+	free(p->text);
+	p->text = initString(&p->text_l);
+}
+
+static int process_command(struct parser_t *p, const char *buf, int start,
+                           size_t length)
+{
+	const char *cp;
+	const char *end;
+	enum command_t cmd;
+
+	cp = buf + start;
+	end = buf + length;
+	if (p->state == PARSE_TEXT) {
+		if (*cp != 1)
+			// Stray control character, just skip it.
+			return 1;
+		p->state = PARSE_CMD;
+		p->adj = ADJ_SET;
+		p->value = 0;
+		cp++;
+	}
+
+	if (p->state == PARSE_CMD && cp < end) {
+		switch (*cp) {
+		case '+':
+			p->adj = ADJ_INC;
+			cp++;
+			break;
+		case '-':
+			p->adj = ADJ_DEC;
+			cp++;
+			break;
+		default:
+			break;
+		}
+		p->state = PARSE_CMD_VALUE;
+	}
+
+	while (cp < end && isdigit((unsigned char) *cp)) {
+		// Saturate rather than overflow on bogus input.
+		if (p->value < 100000)
+			p->value = p->value * 10 + (*cp - '0');
+		cp++;
+	}
+
+	if (cp == end)
+		// The command goes on in the next buffer.
+		return cp - (buf + start);
+
+	switch (*cp) {
+	case 'b':
+		cmd = CMD_SET_PUNCTUATION;
+		break;
+	case 'f':
+		cmd = CMD_SET_FREQUENCY;
+		break;
+	case 'i':
+		cmd = CMD_SET_MARK;
+		break;
+	case 'p':
+		cmd = CMD_SET_PITCH;
+		break;
+	case 'r':
+		cmd = CMD_SET_RANGE;
+		break;
+	case 's':
+		cmd = CMD_SET_RATE;
+		break;
+	case 'v':
+		cmd = CMD_SET_VOLUME;
+		break;
+	case 'P':
+		cmd = CMD_PAUSE;
+		break;
+	default:
+		cmd = CMD_UNKNOWN;
+		break;
+	}
+	cp++;
+	p->state = PARSE_TEXT;
+
+	if (cmd != CMD_FLUSH && cmd != CMD_UNKNOWN) {
+		if (p->mode == ESPEAKUP_MODE_ACSINT && p->text_l != 0)
+			flush_text(p);
+		p->cb->command(p->data, cmd, p->adj, p->value);
+	}
+
+	return cp - (buf + start);
+}
+
+static void process_buffer(struct parser_t *p, const char *buf, size_t length)
+{
+	size_t start;
+	size_t end;
+	char txtBuf[PARSER_MAX_INPUT + sizeof(p->partial) + 1];
+	size_t txtLen;
+	int tail;
+
+	start = 0;
+	end = 0;
+	if (p->partial_len && (length == 0 || !is_text(buf[0])))
+		/* The character was never completed: drop the garbage rather
+		 * than have it spelled out. */
+		p->partial_len = 0;
+	if (p->state != PARSE_TEXT && length > 0)
+		start = end = process_command(p, buf, 0, length);
+	while (start < length) {
+		while (end < length && is_text(buf[end]))
+			end++;
+		if (end != start) {
+			txtLen = p->partial_len;
+			memcpy(txtBuf, p->partial, txtLen);
+			p->partial_len = 0;
+			memcpy(txtBuf + txtLen, buf + start, end - start);
+			txtLen += end - start;
+			/* Along with the bytes saved from the previous read: a
+			 * character may be cut by several reads. */
+			tail = 0;
+			if (end == length)
+				tail = utf8_incomplete_tail(txtBuf, txtLen);
+			if (tail) {
+				txtLen -= tail;
+				memcpy(p->partial, txtBuf + txtLen, tail);
+				p->partial_len = tail;
+			}
+			*(txtBuf + txtLen) = 0;
+			if (txtLen)
+				add_text(p, txtBuf, txtLen);
+		}
+		if (end < length)
+			start = end = end + process_command(p, buf, end, length);
+		else
+			start = length;
+	}
+}
+
+static void process_buffer_acsint(struct parser_t *p, const char *buf,
+                                  size_t length)
+{
+	size_t start = 0;
+	size_t i;
+	int flushIt = 0;
+
+	/* Partial UTF-8 characters need no care here: text is accumulated
+	 * until the end of the line anyway. */
+	if (p->state != PARSE_TEXT && length > 0)
+		start = process_command(p, buf, 0, length);
+	while (start < length) {
+		for (i = start; i < length; i++) {
+			if (buf[i] == '\r' || buf[i] == '\n')
+				flushIt = 1;
+			if (buf[i] >= 0 && buf[i] < ' ')
+				break;
+		}
+		if (i > start)
+			stringAndBytes(&p->text, &p->text_l, buf + start, i - start);
+		if (flushIt) {
+			if (p->text != EMPTYSTRING)
+				flush_text(p);
+			flushIt = 0;
+		}
+		if (i < length)
+			start = i = i + process_command(p, buf, i, length);
+		else
+			start = length;
+	}
+}
+
+/* Parse a piece of input.  A flush makes everything before it obsolete,
+ * including whatever the parser was in the middle of. */
+void parser_feed(struct parser_t *p, const char *buf, size_t length)
+{
+	const char *flush;
+	size_t n;
+
+	flush = memrchr(buf, synthFlushChar, length);
+	if (flush) {
+		p->cb->flush(p->data);
+		parser_reset(p);
+		length -= flush + 1 - buf;
+		buf = flush + 1;
+	}
+	while (length > 0) {
+		n = length < PARSER_MAX_INPUT ? length : PARSER_MAX_INPUT;
+		if (p->mode == ESPEAKUP_MODE_SPEAKUP)
+			process_buffer(p, buf, n);
+		else
+			process_buffer_acsint(p, buf, n);
+		buf += n;
+		length -= n;
+	}
+}
+
@@ -0,0 +1,50 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PARSER_H
+#define __PARSER_H
+
+#include <stddef.h>
+
+#include "espeakup.h"
+
+/* Largest piece of input the parser handles at once, the size of a read
+ * from the softsynth device.  Longer input is fed in several pieces. */
+#define PARSER_MAX_INPUT (16 * 1024)
+
+/* What the parser found in its input */
+struct parser_callbacks_t {
+	void (*text)(void *data, const char *txt, size_t length);
+	void (*command)(void *data, enum command_t cmd, enum adjust_t adj,
+	                int value);
+	void (*flush)(void *data);
+};
+
+struct parser_t;     // An opaque type.
+struct substitutions_t;
+
+extern struct parser_t *new_parser(enum espeakup_mode_t mode,
+                                   const struct parser_callbacks_t *cb,
+                                   void *data);
+extern void free_parser(struct parser_t *p);
+extern void parser_set_substitutions(struct parser_t *p,
+                                     struct substitutions_t *d);
+extern void parser_feed(struct parser_t *p, const char *buf, size_t length);
+
+#endif
@@ -0,0 +1,401 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Synthesis-ahead worker pool.  Espeak is not thread-safe, so to
+ * synthesize on more than one core, worker processes are forked at
+ * startup, each running its own engine.  The texts coming up in the queue
+ * are handed over to them, and they render the audio into shared memory
+ * while the main process plays the current entry.  The main process
+ * then plays their audio in order as it comes.
+ *
+ * Each worker owns one slot in shared memory, which holds the text and
+ * parameters of its job and a ring of rendered samples.  The worker is
+ * woken up through a pipe when it is given a job; otherwise both sides
+ * communicate through atomic counters in the slot, and wait for each
+ * other on futexes there: the worker when the ring is full, the main
+ * process when the worker is behind playback.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "espeakup.h"
+#include "pool.h"
+#include "stats.h"
+
+/* About 12 seconds of audio at 22050Hz: a worker which gets that far
+ * ahead of playback just waits. */
+#define POOL_RING_SAMPLES (1 << 18)
+#define POOL_MAX_TEXT (16 * 1024 + 1)
+#define POOL_MAX_MARKS 256
+
+/* How long the main process waits for a worker at most before checking
+ * that it is still alive, in nanoseconds */
+#define POOL_WAIT_NS 100000000L
+
+enum slot_state_t
+{
+	SLOT_IDLE,
+	SLOT_QUEUED,
+	SLOT_RUNNING,
+	SLOT_FINISHED,
+};
+
+struct pool_slot_t {
+	atomic_int state;
+	atomic_int cancel;
+	atomic_int failed;
+	struct synth_t params;
+	int text_len;
+	char text[POOL_MAX_TEXT];
+	atomic_long written;
+	atomic_long consumed;
+	atomic_int nmarks;
+	/* Bumped when the worker wrote samples or finished, and when the
+	 * ring got room or the job was cancelled, to wait on as futexes,
+	 * with whether anybody waits. */
+	atomic_int progress;
+	atomic_int main_waiting;
+	atomic_int room;
+	atomic_int worker_waiting;
+	struct pcm_mark_t marks[POOL_MAX_MARKS];
+	short ring[POOL_RING_SAMPLES];
+};
+
+/* Main process bookkeeping */
+static struct {
+	pid_t pid;
+	int fd;          // write end of the wakeup pipe
+	int in_use;      // the job belongs to a queue entry
+} workers[POOL_MAX_WORKERS];
+
+static struct pool_slot_t *slots = NULL;
+static int nslots = 0;
+
+/* Sleep until *word is bumped, if it still is seq, or for timeout_ns if
+ * not 0.  The slots are shared between processes: no FUTEX_PRIVATE_FLAG. */
+static void futex_wait(atomic_int *word, int seq, long timeout_ns)
+{
+	struct timespec ts = {0, timeout_ns};
+
+	syscall(SYS_futex, word, FUTEX_WAIT, seq, timeout_ns ? &ts : NULL,
+	        NULL, 0);
+}
+
+static void futex_bump(atomic_int *word, atomic_int *waiting)
+{
+	atomic_fetch_add(word, 1);
+	if (atomic_load(waiting))
+		syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static void worker_main(int job, int fd, pool_init_t init,
+                        pool_render_t render)
+{
+	struct pool_slot_t *slot = &slots[job];
+	char c;
+	int failed;
+
+	// Do not outlive the main process.
+	prctl(PR_SET_PDEATHSIG, SIGTERM);
+	if (init() < 0)
+		_exit(1);
+	while (read(fd, &c, 1) == 1) {
+		atomic_store(&slot->state, SLOT_RUNNING);
+		failed = 0;
+		if (!atomic_load(&slot->cancel))
+			failed = render(job, &slot->params, slot->text, slot->text_len);
+		atomic_store(&slot->failed, failed < 0);
+		atomic_store(&slot->state, SLOT_FINISHED);
+		futex_bump(&slot->progress, &slot->main_waiting);
+	}
+	_exit(0);
+}
+
+/* Fork the workers.  This must be done before any thread is created. */
+int pool_start(int nworkers, pool_init_t init, pool_render_t render)
+{
+	int i;
+	int fds[2];
+	pid_t pid;
+
+	if (nworkers > POOL_MAX_WORKERS)
+		nworkers = POOL_MAX_WORKERS;
+	slots = mmap(NULL, nworkers * sizeof(struct pool_slot_t),
+	             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (slots == MAP_FAILED) {
+		perror("Unable to allocate the worker pool");
+		slots = NULL;
+		return -1;
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		if (pipe(fds) < 0) {
+			perror("Unable to create a worker pipe");
+			break;
+		}
+		pid = fork();
+		if (pid < 0) {
+			perror("Unable to fork a worker");
+			close(fds[0]);
+			close(fds[1]);
+			break;
+		}
+		if (!pid) {
+			int j;
+			close(fds[1]);
+			for (j = 0; j < i; j++)
+				close(workers[j].fd);
+			worker_main(i, fds[0], init, render);
+		}
+		close(fds[0]);
+		workers[i].pid = pid;
+		workers[i].fd = fds[1];
+		workers[i].in_use = 0;
+		atomic_store(&slots[i].state, SLOT_IDLE);
+	}
+	nslots = i;
+	stats_set(STATS_ESPEAK, STAT_WORKERS, nslots);
+	return nslots ? 0 : -1;
+}
+
+void pool_stop(void)
+{
+	int i;
+
+	for (i = 0; i < nslots; i++) {
+		if (!workers[i].pid)
+			continue;
+		close(workers[i].fd);
+		kill(workers[i].pid, SIGTERM);
+		waitpid(workers[i].pid, NULL, 0);
+	}
+	nslots = 0;
+}
+
+void pool_signal(int sig)
+{
+	int i;
+
+	for (i = 0; i < nslots; i++)
+		if (workers[i].pid)
+			kill(workers[i].pid, sig);
+}
+
+int pool_size(void)
+{
+	return nslots;
+}
+
+/* Hand a text over to an idle worker.  Returns the job, or -1 if all the
+ * workers are busy. */
+int pool_submit(const struct synth_t *params, const char *text, int len)
+{
+	struct pool_slot_t *slot;
+	int state;
+	int i;
+
+	if (len >= POOL_MAX_TEXT)
+		return -1;
+	for (i = 0; i < nslots; i++) {
+		if (!workers[i].pid || workers[i].in_use)
+			continue;
+		slot = &slots[i];
+		state = atomic_load(&slot->state);
+		if (state != SLOT_IDLE && state != SLOT_FINISHED)
+			// Still aborting a cancelled job.
+			continue;
+		slot->params = *params;
+		memcpy(slot->text, text, len);
+		slot->text[len] = 0;
+		slot->text_len = len;
+		atomic_store(&slot->cancel, 0);
+		atomic_store(&slot->failed, 0);
+		atomic_store(&slot->written, 0);
+		atomic_store(&slot->consumed, 0);
+		atomic_store(&slot->nmarks, 0);
+		atomic_store(&slot->state, SLOT_QUEUED);
+		if (write(workers[i].fd, "j", 1) != 1) {
+			atomic_store(&slot->state, SLOT_IDLE);
+			continue;
+		}
+		workers[i].in_use = 1;
+		return i;
+	}
+	return -1;
+}
+
+/* The job is not needed anymore: finished, or flushed. */
+void pool_release(int job)
+{
+	atomic_store(&slots[job].cancel, 1);
+	futex_bump(&slots[job].room, &slots[job].worker_waiting);
+	workers[job].in_use = 0;
+}
+
+/* A dead worker is not started again: forking the main process once its
+ * threads run is not safe.  The pool shrinks, and the statistics show it.
+ * Synthesis falls back to the espeak thread when no worker is left. */
+static int worker_alive(int job)
+{
+	if (!workers[job].pid)
+		return 0;
+	if (waitpid(workers[job].pid, NULL, WNOHANG) == 0)
+		return 1;
+	fprintf(stderr, "espeakup: synthesis worker %d died\n", job);
+	close(workers[job].fd);
+	workers[job].pid = 0;
+	stats_add(STATS_ESPEAK, STAT_WORKERS_LOST, 1);
+	stats_set(STATS_ESPEAK, STAT_WORKERS,
+	          stats_get(STATS_ESPEAK, STAT_WORKERS) - 1);
+	return 0;
+}
+
+enum pool_job_status_t pool_job_poll(int job, long *written, int *nmarks)
+{
+	struct pool_slot_t *slot = &slots[job];
+	int state = atomic_load(&slot->state);
+
+	*nmarks = atomic_load(&slot->nmarks);
+	*written = atomic_load(&slot->written);
+	if (state == SLOT_FINISHED)
+		return atomic_load(&slot->failed) ? POOL_JOB_FAILED : POOL_JOB_DONE;
+	if (*written == atomic_load(&slot->consumed) && !worker_alive(job))
+		return POOL_JOB_FAILED;
+	return POOL_JOB_RUNNING;
+}
+
+/* Get the rendered samples available from pos on, in one piece. */
+
+int pool_job_samples(int job, long pos, const short **samples)
+{
+	struct pool_slot_t *slot = &slots[job];
+	long avail = atomic_load(&slot->written) - pos;
+	long offset = pos % POOL_RING_SAMPLES;
+
+	if (avail > POOL_RING_SAMPLES - offset)
+		avail = POOL_RING_SAMPLES - offset;
+	*samples = slot->ring + offset;
+	return avail;
+}
+
+void pool_job_consumed(int job, long pos)
+{
+	atomic_store(&slots[job].consumed, pos);
+	futex_bump(&slots[job].room, &slots[job].worker_waiting);
+}
+
+/* Wait for the worker to get past written samples, or to finish the job,
+ * for a while.  With stop, a thread setting *stop then calling
+ * pool_interrupt cuts the wait short. */
+void pool_job_wait(int job, long written, volatile int *stop)
+{
+	struct pool_slot_t *slot = &slots[job];
+	int seq;
+
+	atomic_store(&slot->main_waiting, 1);
+	seq = atomic_load(&slot->progress);
+	if (atomic_load(&slot->written) == written &&
+	    atomic_load(&slot->state) != SLOT_FINISHED && !(stop && *stop))
+		futex_wait(&slot->progress, seq, POOL_WAIT_NS);
+	atomic_store(&slot->main_waiting, 0);
+}
+
+/* Wake up the main process waiting for a worker, to notice a stop. */
+void pool_interrupt(void)
+{
+	int i;
+
+	for (i = 0; i < nslots; i++)
+		futex_bump(&slots[i].progress, &slots[i].main_waiting);
+}
+
+const struct pcm_mark_t *pool_job_mark(int job, int i)
+{
+	return &slots[job].marks[i];
+}
+
+int pool_job_cancelled(int job)
+{
+	return atomic_load(&slots[job].cancel);
+}
+
+/* Add samples to the job, waiting for the main process to play enough of
+ * them if the ring is full. */
+int pool_job_write(int job, const short *samples, int n)
+{
+	struct pool_slot_t *slot = &slots[job];
+	long written = atomic_load(&slot->written);
+	long offset;
+	int count;
+	int seq;
+
+	while (n > 0) {
+		atomic_store(&slot->worker_waiting, 1);
+		for (;;) {
+			seq = atomic_load(&slot->room);
+			if (atomic_load(&slot->cancel)) {
+				atomic_store(&slot->worker_waiting, 0);
+				return -1;
+			}
+			if (written - atomic_load(&slot->consumed) < POOL_RING_SAMPLES)
+				break;
+			futex_wait(&slot->room, seq, 0);
+		}
+		atomic_store(&slot->worker_waiting, 0);
+		count = POOL_RING_SAMPLES - (written - atomic_load(&slot->consumed));
+		if (count > n)
+			count = n;
+		offset = written % POOL_RING_SAMPLES;
+		if (count > POOL_RING_SAMPLES - offset)
+			count = POOL_RING_SAMPLES - offset;
+		memcpy(slot->ring + offset, samples, count * sizeof(short));
+		samples += count;
+		n -= count;
+		written += count;
+		atomic_store(&slot->written, written);
+		futex_bump(&slot->progress, &slot->main_waiting);
+	}
+	return 0;
+}
+
+/* Marks must be added before the samples which follow them. */
+int pool_job_add_mark(int job, int offset, int value)
+{
+	struct pool_slot_t *slot = &slots[job];
+	int n = atomic_load(&slot->nmarks);
+
+	if (n == POOL_MAX_MARKS)
+		return -1;
+	slot->marks[n].offset = offset;
+	slot->marks[n].value = value;
+	atomic_store(&slot->nmarks, n + 1);
+	return 0;
+}
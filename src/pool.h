@@ -0,0 +1,62 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POOL_H
+#define __POOL_H
+
+#include "cache.h"
+
+#define POOL_MAX_WORKERS 16
+
+struct synth_t;
+
+enum pool_job_status_t
+{
+	POOL_JOB_RUNNING,
+	POOL_JOB_DONE,
+	POOL_JOB_FAILED,
+};
+
+/* Run in each worker process: once at startup, then for each job. */
+typedef int (*pool_init_t)(void);
+typedef int (*pool_render_t)(int job, const struct synth_t *params,
+                             const char *text, int len);
+
+/* Main process side */
+extern int pool_start(int nworkers, pool_init_t init, pool_render_t render);
+extern void pool_stop(void);
+extern int pool_size(void);
+extern void pool_signal(int sig);
+extern int pool_submit(const struct synth_t *params, const char *text,
+                       int len);
+extern void pool_release(int job);
+extern enum pool_job_status_t pool_job_poll(int job, long *written,
+                                            int *nmarks);
+extern int pool_job_samples(int job, long pos, const short **samples);
+extern void pool_job_consumed(int job, long pos);
+extern void pool_job_wait(int job, long written, volatile int *stop);
+extern void pool_interrupt(void);
+extern const struct pcm_mark_t *pool_job_mark(int job, int i);
+
+/* Worker process side */
+extern int pool_job_cancelled(int job);
+extern int pool_job_write(int job, const short *samples, int n);
+extern int pool_job_add_mark(int job, int offset, int value);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __PROBES_H
+#define __PROBES_H
+
+/* USDT probes, for perf and bpftrace, in the espeakup provider.  They are
+ * a nop unless something is attached to them.  Entries are identified by
+ * the id the softsynth thread, or the supervisor, gives them.
+ *
+ *   read(bytes)                   read from the softsynth device
+ *   enqueue(id, cmd, length)      entry added to the queue
+ *   dequeue(id, cmd, length)      entry taken up by the espeak thread
+ *   synth_start(id, length)       espeak_Synth called
+ *   synth_end(id, error)          espeak_Synth returned
+ *   synth_callback(id, samples)   audio handed over by espeak-ng
+ *   mark(value)                   index mark reported
+ *   flush_request()               flush sent to the espeak thread
+ *   flush_ack(dropped)            flush done, with the entries dropped
+ *   restart(attempt)              espeak-ng restarted
+ *   failover(attempt)             standby engine took over, --standby
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define PROBE0(name) DTRACE_PROBE(espeakup, name)
+#define PROBE1(name, a) DTRACE_PROBE1(espeakup, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(espeakup, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(espeakup, name, a, b, c)
+#else
+// The arguments are mere variables, which this keeps from being unused.
+#define PROBE0(name) do {} while (0)
+#define PROBE1(name, a) do { (void) (a); } while (0)
+#define PROBE2(name, a, b) do { (void) (a); (void) (b); } while (0)
+#define PROBE3(name, a, b, c) \
+	do { (void) (a); (void) (b); (void) (c); } while (0)
+#endif
+
+#endif
@@ -86,3 +86,15 @@ void *queue_peek(struct queue_t *q)
 	else
 		return NULL;
 }
+
+/* Call fn on each entry, from the head of the queue, until it returns
+ * nonzero. */
+void queue_foreach(struct queue_t *q, int (*fn)(void *data, void *arg),
+                   void *arg)
+{
+	struct queue_entry_t *tmp;
+
+	for (tmp = q->head; tmp; tmp = tmp->next)
+		if (fn(tmp->data, arg))
+			break;
+}
@@ -26,5 +26,7 @@ extern struct queue_t *new_queue(void);
 extern int queue_add(struct queue_t *q, void *entry);
 extern void *queue_remove(struct queue_t *q);
 extern void *queue_peek(struct queue_t *q);
+extern void queue_foreach(struct queue_t *q, int (*fn)(void *entry, void *arg),
+                          void *arg);
 
 #endif
@@ -0,0 +1,247 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Opt-in real-time mode.  Speech must not stutter when the machine is
+ * loaded, nor start late because the engine was paged out while idle: the
+ * audio path can run with a real-time scheduling policy, and all the
+ * memory can be locked.  Everything here falls back to the normal
+ * behaviour, with a warning, when the privileges are missing.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "realtime.h"
+
+/* Real-time priority of the playback thread, 0 when not real-time */
+int realtimePriority = 0;
+
+/* SCHED_FIFO or SCHED_RR */
+int realtimePolicy = SCHED_FIFO;
+
+/* CPUs to run on, as a list like "0,2-3", or NULL for any */
+char *cpuAffinity = NULL;
+
+/* With all memory locked, each thread stack is locked in full: keep them
+ * small. */
+static const size_t lockedStackSize = 256 * 1024;
+
+/* How much of its stack a real-time thread touches up front */
+#define PREFAULT_STACK (64 * 1024)
+
+static int memory_locked = 0;
+
+static int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+	const char *p = list;
+	char *end;
+	long first, last;
+
+	CPU_ZERO(set);
+	do {
+		first = strtol(p, &end, 10);
+		if (end == p || first < 0 || first >= CPU_SETSIZE)
+			return -1;
+		last = first;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p || last < first || last >= CPU_SETSIZE)
+				return -1;
+		}
+		for (; first <= last; first++)
+			CPU_SET(first, set);
+		p = end + 1;
+	} while (*end == ',');
+	return *end ? -1 : 0;
+}
+
+int valid_cpu_list(const char *list)
+{
+	cpu_set_t set;
+
+	return parse_cpu_list(list, &set) == 0;
+}
+
+/* Process-wide settings, to be applied before the threads are created so
+ * that their stacks get locked too. */
+void setup_realtime(void)
+{
+	cpu_set_t set;
+
+	if (cpuAffinity && !parse_cpu_list(cpuAffinity, &set) &&
+	    sched_setaffinity(0, sizeof(set), &set) < 0)
+		fprintf(stderr, "Unable to set the CPU affinity: %s\n",
+		        strerror(errno));
+
+	if (!realtimePriority)
+		return;
+	/* Lock what is mapped now (the espeak-ng library) and everything
+	 * mapped later: the voice data espeak-ng loads at initialization,
+	 * the thread stacks, the audio ring. */
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		fprintf(stderr, "Unable to lock memory, continuing without: %s\n",
+		        strerror(errno));
+	else
+		memory_locked = 1;
+}
+
+/* Create a thread, with the given real-time priority if real-time mode
+ * is on and priority is not 0. */
+int create_thread(pthread_t *thread, void *(*fn)(void *), void *arg,
+                  int priority)
+{
+	struct sched_param param = {.sched_priority = priority};
+	pthread_attr_t attr;
+	int err;
+
+	pthread_attr_init(&attr);
+	if (memory_locked)
+		pthread_attr_setstacksize(&attr, lockedStackSize);
+	if (realtimePriority && priority) {
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, realtimePolicy);
+		pthread_attr_setschedparam(&attr, &param);
+		err = pthread_create(thread, &attr, fn, arg);
+		if (err != EPERM && err != EINVAL) {
+			pthread_attr_destroy(&attr);
+			return err;
+		}
+		fprintf(stderr, "Unable to use real-time scheduling, continuing "
+		        "without: %s\n", strerror(err));
+		pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+	}
+	err = pthread_create(thread, &attr, fn, arg);
+	pthread_attr_destroy(&attr);
+	return err;
+}
+
+/* Touch the top of the stack of the calling thread, so that a real-time
+ * thread does not fault pages in later. */
+void prefault_stack(void)
+{
+	volatile char stack[PREFAULT_STACK];
+	size_t i;
+
+	if (!realtimePriority)
+		return;
+	for (i = 0; i < sizeof(stack); i += 4096)
+		stack[i] = 0;
+}
+
+// The kernel id of the calling thread
+long thread_id(void)
+{
+	static __thread long tid = 0;
+
+	if (!tid)
+		tid = syscall(SYS_gettid);
+	return tid;
+}
+
+/* Read the page faults and the scheduling delay of a thread, which may
+ * belong to another process.  The scheduling delay stays 0 when the
+ * kernel does not keep it. */
+int thread_usage(long tid, struct thread_usage_t *u)
+{
+	char path[64];
+	char line[512];
+	char *p = NULL;
+	FILE *f;
+
+	memset(u, 0, sizeof(*u));
+	snprintf(path, sizeof(path), "/proc/%ld/task/%ld/stat", tid, tid);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	// The command name in parentheses may contain spaces.
+	if (fgets(line, sizeof(line), f))
+		p = strrchr(line, ')');
+	fclose(f);
+	if (!p || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %lu %*u %lu",
+	                 &u->minor_faults, &u->major_faults) != 2)
+		return -1;
+
+	/* Time spent running, time spent waiting to run on a runqueue, and
+	 * number of timeslices. */
+	snprintf(path, sizeof(path), "/proc/%ld/task/%ld/schedstat", tid, tid);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	if (fscanf(f, "%*u %llu %llu", &u->delay_ns, &u->timeslices) != 2)
+		u->delay_ns = u->timeslices = 0;
+	fclose(f);
+	return 0;
+}
+
+/* Print the page faults and the scheduling delay of the calling thread. */
+void print_thread_stats(const char *name)
+{
+	struct thread_usage_t u;
+
+	if (thread_usage(thread_id(), &u) < 0)
+		return;
+	printf("%s thread: %lu major faults, %lu minor faults\n", name,
+	       u.major_faults, u.minor_faults);
+	if (u.timeslices)
+		printf("%s thread: %llu ms scheduling delay over %llu timeslices "
+		       "(%.3f ms average)\n", name, u.delay_ns / 1000000,
+		       u.timeslices, u.delay_ns / 1e6 / u.timeslices);
+}
+
+long long monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// CPU time used by the calling thread
+long long thread_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void duration_add(struct duration_stats_t *d, long long ns)
+{
+	d->count++;
+	d->total_ns += ns;
+	if (ns > d->max_ns)
+		d->max_ns = ns;
+}
+
+void print_duration_stats(const char *what, const struct duration_stats_t *d)
+{
+	if (!d->count)
+		return;
+	printf("%s: %.3f ms average, %.3f ms max over %lu\n", what,
+	       d->total_ns / 1e6 / d->count, d->max_ns / 1e6, d->count);
+}
@@ -0,0 +1,60 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REALTIME_H
+#define __REALTIME_H
+
+#include <pthread.h>
+
+extern int realtimePriority;
+extern int realtimePolicy;
+extern char *cpuAffinity;
+
+extern int valid_cpu_list(const char *list);
+extern void setup_realtime(void);
+extern int create_thread(pthread_t *thread, void *(*fn)(void *), void *arg,
+                         int priority);
+extern void prefault_stack(void);
+
+/* Page faults and scheduling delay of a thread */
+struct thread_usage_t {
+	unsigned long major_faults;
+	unsigned long minor_faults;
+	unsigned long long delay_ns;    // waiting to run on a runqueue
+	unsigned long long timeslices;
+};
+
+extern long thread_id(void);
+extern int thread_usage(long tid, struct thread_usage_t *u);
+extern void print_thread_stats(const char *name);
+
+/* Running statistics of a duration */
+struct duration_stats_t {
+	unsigned long count;
+	long long total_ns;
+	long long max_ns;
+};
+
+extern long long monotonic_ns(void);
+extern long long thread_cpu_ns(void);
+extern void duration_add(struct duration_stats_t *d, long long ns);
+extern void print_duration_stats(const char *what,
+                                 const struct duration_stats_t *d);
+
+#endif
@@ -0,0 +1,414 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Offline rendering: a file in the softsynth protocol, parsed as from
+ * Speakup, is synthesized by the worker processes as fast as they can,
+ * into a WAV file.  The index marks become cue points.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "espeakup.h"
+#include "parser.h"
+#include "pool.h"
+#include "stringhandling.h"
+
+/* What to render, and where to, "-" for stdin and stdout. */
+int renderMode = 0;
+char *renderInput = "-";
+char *renderOutput = "-";
+
+extern int synthWorkers;
+extern char *defaultVoice;
+extern int defaultFrequency;
+extern int defaultPitch;
+extern int defaultRange;
+extern int defaultRate;
+extern int defaultVolume;
+
+/* The input, parsed: the texts along with the parameters they are to be
+ * spoken with, and the index marks between them. */
+struct render_item_t {
+	struct synth_t params;     // params.buf is the text, NULL for a mark
+	int mark;
+	int job;
+};
+
+struct render_t {
+	struct synth_t params;
+	struct render_item_t *items;
+	int nitems;
+	int size;
+	long text_bytes;
+	// Output
+	FILE *out;
+	long samples;
+	struct pcm_mark_t *cues;     // where the marks fell
+	int ncues;
+	int cues_size;
+};
+
+static struct render_item_t *new_item(struct render_t *r)
+{
+	if (r->nitems == r->size) {
+		r->size *= 2;
+		r->items = reallocMem(r->items,
+		                      r->size * sizeof(struct render_item_t));
+	}
+	memset(&r->items[r->nitems], 0, sizeof(struct render_item_t));
+	r->items[r->nitems].params = r->params;
+	r->items[r->nitems].job = -1;
+	return &r->items[r->nitems++];
+}
+
+static void add_text(void *data, const char *txt, size_t length)
+{
+	struct render_t *r = data;
+	struct render_item_t *item = new_item(r);
+
+	item->params.buf = allocMem(length + 1);
+	memcpy(item->params.buf, txt, length);
+	item->params.buf[length] = 0;
+	item->params.len = length;
+	r->text_bytes += length;
+}
+
+static void add_command(void *data, enum command_t cmd, enum adjust_t adj,
+                        int value)
+{
+	struct render_t *r = data;
+
+	if (cmd == CMD_SET_MARK)
+		new_item(r)->mark = value;
+	else
+		adjust_params(&r->params, cmd, adj, value);
+}
+
+static void clear_items(void *data)
+{
+	struct render_t *r = data;
+	int i;
+
+	for (i = 0; i < r->nitems; i++)
+		free(r->items[i].params.buf);
+	r->nitems = 0;
+	r->text_bytes = 0;
+}
+
+static const struct parser_callbacks_t render_callbacks = {
+	.text = add_text,
+	.command = add_command,
+	.flush = clear_items,
+};
+
+static int parse_input(struct render_t *r)
+{
+	struct parser_t *parser;
+	FILE *in = stdin;
+	char buf[PARSER_MAX_INPUT];
+	size_t n;
+
+	if (strcmp(renderInput, "-")) {
+		in = fopen(renderInput, "rb");
+		if (!in) {
+			fprintf(stderr, "Unable to read %s: %s\n", renderInput,
+			        strerror(errno));
+			return -1;
+		}
+	}
+	parser = new_speech_parser(&render_callbacks, r);
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+		parser_feed(parser, buf, n);
+	free_parser(parser);
+	if (in != stdin)
+		fclose(in);
+	return 0;
+}
+
+static void put_le(unsigned char *p, uint32_t v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		p[i] = v >> (8 * i);
+}
+
+/* The sizes are not known until the end: they are left at their maximum,
+ * as in a stream, and patched at the end if the output is a file. */
+static int write_header(struct render_t *r, int rate)
+{
+	unsigned char h[44];
+
+	memcpy(h, "RIFF", 4);
+	put_le(h + 4, 0xffffffff, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le(h + 16, 16, 4);
+	put_le(h + 20, 1, 2);            // PCM
+	put_le(h + 22, 1, 2);            // mono
+	put_le(h + 24, rate, 4);
+	put_le(h + 28, rate * 2, 4);     // bytes per second
+	put_le(h + 32, 2, 2);            // bytes per frame
+	put_le(h + 34, 16, 2);           // bits per sample
+	memcpy(h + 36, "data", 4);
+	put_le(h + 40, 0xffffffff, 4);
+	return fwrite(h, sizeof(h), 1, r->out) == 1 ? 0 : -1;
+}
+
+static int write_samples(struct render_t *r, const short *samples, int n)
+{
+	unsigned char buf[4096];
+	int i, count;
+
+	while (n > 0) {
+		count = n < (int) sizeof(buf) / 2 ? n : (int) sizeof(buf) / 2;
+		for (i = 0; i < count; i++)
+			put_le(buf + 2 * i, (uint16_t) samples[i], 2);
+		if (fwrite(buf, 2, count, r->out) != (size_t) count)
+			return -1;
+		samples += count;
+		n -= count;
+		r->samples += count;
+	}
+	return 0;
+}
+
+static void add_cue(struct render_t *r, long pos, int value)
+{
+	if (r->ncues == r->cues_size) {
+		r->cues_size *= 2;
+		r->cues = reallocMem(r->cues,
+		                     r->cues_size * sizeof(struct pcm_mark_t));
+	}
+	r->cues[r->ncues].offset = pos;
+	r->cues[r->ncues].value = value;
+	r->ncues++;
+}
+
+/* Append the marks as a cue chunk, with their values as labels, and patch
+ * the sizes in.  Only possible if the output is seekable. */
+static int finish_file(struct render_t *r)
+{
+	unsigned char b[24];
+	long data_bytes = r->samples * 2;
+	long riff_bytes;
+	char label[16];
+	long adtl = 4;
+	int i, l;
+
+	if (fseek(r->out, 0, SEEK_END) < 0)
+		// A pipe: leave the sizes as for a stream.
+		return 0;
+	if (r->ncues) {
+		memcpy(b, "cue ", 4);
+		put_le(b + 4, 4 + 24 * r->ncues, 4);
+		put_le(b + 8, r->ncues, 4);
+		fwrite(b, 12, 1, r->out);
+		for (i = 0; i < r->ncues; i++) {
+			put_le(b, i + 1, 4);
+			put_le(b + 4, r->cues[i].offset, 4);
+			memcpy(b + 8, "data", 4);
+			put_le(b + 12, 0, 4);
+			put_le(b + 16, 0, 4);
+			put_le(b + 20, r->cues[i].offset, 4);
+			fwrite(b, 24, 1, r->out);
+		}
+		for (i = 0; i < r->ncues; i++) {
+			l = snprintf(label, sizeof(label), "%d", r->cues[i].value) + 1;
+			adtl += 12 + l + (l & 1);
+		}
+		memcpy(b, "LIST", 4);
+		put_le(b + 4, adtl, 4);
+		memcpy(b + 8, "adtl", 4);
+		fwrite(b, 12, 1, r->out);
+		for (i = 0; i < r->ncues; i++) {
+			l = snprintf(label, sizeof(label), "%d", r->cues[i].value) + 1;
+			memcpy(b, "labl", 4);
+			put_le(b + 4, 4 + l, 4);
+			put_le(b + 8, i + 1, 4);
+			fwrite(b, 12, 1, r->out);
+			fwrite(label, l + (l & 1), 1, r->out);
+		}
+	}
+	riff_bytes = ftell(r->out) - 8;
+	put_le(b, riff_bytes, 4);
+	if (fseek(r->out, 4, SEEK_SET) < 0 || fwrite(b, 4, 1, r->out) != 1)
+		return -1;
+	put_le(b, data_bytes, 4);
+	if (fseek(r->out, 40, SEEK_SET) < 0 || fwrite(b, 4, 1, r->out) != 1)
+		return -1;
+	return 0;
+}
+
+/* Hand the texts over to the workers as they become idle, and collect
+ * their audio in order: each worker buffers some ahead. */
+static int render_items(struct render_t *r)
+{
+	enum pool_job_status_t status;
+	struct render_item_t *item;
+	const struct pcm_mark_t *mark;
+	const short *samples;
+	long written, pos = 0, start = 0;
+	int head = 0, next = 0;
+	int nmarks, m = 0;
+	int n;
+
+	while (head < r->nitems) {
+		while (next < r->nitems) {
+			item = &r->items[next];
+			if (item->params.buf) {
+				item->job = pool_submit(&item->params, item->params.buf,
+				                        item->params.len);
+				if (item->job < 0)
+					break;
+			}
+			next++;
+		}
+
+		item = &r->items[head];
+		if (!item->params.buf) {
+			add_cue(r, r->samples, item->mark);
+			head++;
+			continue;
+		}
+		if (item->job < 0) {
+			// Too long for a worker, or all of them died.
+			fprintf(stderr, "Unable to render \"%.40s\"\n", item->params.buf);
+			return -1;
+		}
+
+		status = pool_job_poll(item->job, &written, &nmarks);
+		for (; m < nmarks; m++) {
+			mark = pool_job_mark(item->job, m);
+			add_cue(r, start + mark->offset, mark->value);
+		}
+		if (pos < written) {
+			n = pool_job_samples(item->job, pos, &samples);
+			if (write_samples(r, samples, n) < 0) {
+				perror("Unable to write the audio");
+				return -1;
+			}
+			pos += n;
+			pool_job_consumed(item->job, pos);
+			continue;
+		}
+		if (status == POOL_JOB_RUNNING) {
+			pool_job_wait(item->job, written, NULL);
+			continue;
+		}
+		if (status == POOL_JOB_FAILED) {
+			fprintf(stderr, "Unable to render \"%.40s\"\n", item->params.buf);
+			return -1;
+		}
+		pool_release(item->job);
+		head++;
+		start = r->samples;
+		pos = 0;
+		m = 0;
+	}
+	return 0;
+}
+
+static double elapsed(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec - since->tv_sec + (now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+/* Render renderInput into renderOutput.  Returns the exit status. */
+int render(void)
+{
+	struct render_t r;
+	struct timespec start;
+	double seconds;
+	int rate;
+	int ret = 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset(&r, 0, sizeof(r));
+	r.size = 64;
+	r.items = allocMem(r.size * sizeof(struct render_item_t));
+	r.cues_size = 64;
+	r.cues = allocMem(r.cues_size * sizeof(struct pcm_mark_t));
+	r.params.frequency = defaultFrequency;
+	r.params.pitch = defaultPitch;
+	r.params.range = defaultRange;
+	r.params.rate = defaultRate;
+	r.params.volume = defaultVolume;
+	if (defaultVoice)
+		snprintf(r.params.voice, sizeof(r.params.voice), "%s", defaultVoice);
+	if (parse_input(&r) < 0)
+		goto out;
+
+	// One engine per CPU, unless told otherwise.
+	if (synthWorkers <= 0)
+		synthWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (start_synthesis_workers() < 0) {
+		fprintf(stderr, "Unable to start the synthesis workers.\n");
+		goto out;
+	}
+	/* Just to learn the sample rate the workers render at.  They run
+	 * espeak-ng synchronously, so a piece is whole once its job is
+	 * finished. */
+	rate = espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0);
+	if (rate < 0) {
+		fprintf(stderr, "Unable to initialize espeak.\n");
+		goto out;
+	}
+	espeak_Terminate();
+
+	r.out = stdout;
+	if (strcmp(renderOutput, "-")) {
+		r.out = fopen(renderOutput, "wb");
+		if (!r.out) {
+			fprintf(stderr, "Unable to write %s: %s\n", renderOutput,
+			        strerror(errno));
+			goto out;
+		}
+	}
+	if (write_header(&r, rate) < 0) {
+		perror("Unable to write the audio");
+	} else if (render_items(&r) == 0) {
+		if (finish_file(&r) < 0 || fflush(r.out) != 0)
+			perror("Unable to write the audio");
+		else
+			ret = 0;
+	}
+	if (r.out != stdout)
+		fclose(r.out);
+
+	seconds = elapsed(&start);
+	fprintf(stderr, "Rendered %.1f s of audio from %ld bytes of text in "
+	        "%.2f s with %d workers: %.1f times real time, %.0f bytes/s\n",
+	        (double) r.samples / rate, r.text_bytes, seconds, pool_size(),
+	        r.samples / (double) rate / seconds, r.text_bytes / seconds);
+
+out:
+	pool_stop();
+	clear_items(&r);
+	free(r.items);
+	free(r.cues);
+	return ret;
+}
@@ -0,0 +1,132 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Suppression of repeated texts, such as the lines which full-screen
+ * programs (clocks, progress bars, top) make Speakup send again each time
+ * they redraw the screen: a text identical to one received less than
+ * repeatWindow milliseconds before is dropped, or shortened to its first
+ * word, rather than synthesized and spoken in full again.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+
+#include "realtime.h"
+#include "repeat.h"
+#include "stats.h"
+
+/* The window in milliseconds, 0 to speak every text.  Only texts of at
+ * least repeatLength bytes are suppressed, so that key echo and short
+ * words read twice on purpose are still spoken. */
+int repeatWindow = 0;
+int repeatLength = 10;
+int repeatMode = REPEAT_DROP;
+
+/* The texts recently spoken in full, by their hash, oldest first from
+ * next_slot on.  Screens seldom have more lines than that. */
+#define REPEAT_SLOTS 64
+
+struct spoken_t {
+	uint64_t hash;
+	size_t length;
+	long long time;
+};
+
+static struct spoken_t spoken[REPEAT_SLOTS];
+static int next_slot = 0;
+
+/* The first text after a flush is always spoken: it is most likely what
+ * the user asked to hear again, such as the current line. */
+static int flushed = 0;
+
+/* FNV-1a */
+static uint64_t hash_text(const char *txt, size_t length)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		h ^= (unsigned char) txt[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+// The length of the text up to the end of its first word.
+static size_t first_word(const char *txt, size_t length)
+{
+	size_t i = 0;
+
+	while (i < length && isspace((unsigned char) txt[i]))
+		i++;
+	while (i < length && !isspace((unsigned char) txt[i]))
+		i++;
+	return i;
+}
+
+/* Returns how much of the text to speak: all of it, none of it if it is
+ * a repeat to drop, or its first word if it is a repeat to shorten.  Only
+ * called by the thread which parses the input. */
+size_t repeat_filter(const char *txt, size_t length)
+{
+	struct spoken_t *s = NULL;
+	uint64_t hash;
+	long long now;
+	size_t keep;
+	int first = flushed;
+	int i;
+
+	flushed = 0;
+	if (!repeatWindow || length < (size_t) repeatLength)
+		return length;
+	hash = hash_text(txt, length);
+	now = monotonic_ns();
+	for (i = 0; i < REPEAT_SLOTS; i++)
+		if (spoken[i].time && spoken[i].hash == hash &&
+		    spoken[i].length == length) {
+			s = &spoken[i];
+			break;
+		}
+
+	if (s && !first && now - s->time < repeatWindow * 1000000LL) {
+		keep = repeatMode == REPEAT_SHORTEN ? first_word(txt, length) : 0;
+		if (keep < length) {
+			stats_add(STATS_SOFTSYNTH, keep ? STAT_REPEATS_SHORTENED :
+			          STAT_REPEATS_DROPPED, 1);
+			stats_add(STATS_SOFTSYNTH, STAT_REPEAT_TEXT_SAVED,
+			          length - keep);
+			return keep;
+		}
+	}
+
+	// Spoken in full: the window starts over.
+	if (!s) {
+		s = &spoken[next_slot];
+		next_slot = (next_slot + 1) % REPEAT_SLOTS;
+		s->hash = hash;
+		s->length = length;
+	}
+	s->time = now;
+	return length;
+}
+
+// Speech was flushed.  Same thread as repeat_filter.
+void repeat_flushed(void)
+{
+	flushed = 1;
+}
@@ -0,0 +1,38 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REPEAT_H
+#define __REPEAT_H
+
+#include <stddef.h>
+
+enum repeat_mode_t
+{
+	REPEAT_DROP,
+	REPEAT_SHORTEN,
+};
+
+extern int repeatWindow;
+extern int repeatLength;
+extern int repeatMode;
+
+extern size_t repeat_filter(const char *txt, size_t length);
+extern void repeat_flushed(void);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Polyphase resampler, from the espeak-ng rate to the native rate of the
+ * sound device, so that ALSA's plug layer does not have to.  The rates
+ * are reduced to up/down; each output sample is the dot product of
+ * the last few input samples with one of up phases of a windowed-sinc
+ * lowpass filter.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsp.h"
+#include "resample.h"
+#include "stringhandling.h"
+
+/* Filter taps per phase, and where the passband ends, relative to the
+ * lower Nyquist frequency. */
+#define RESAMPLE_TAPS 32
+#define RESAMPLE_CUTOFF 0.9
+
+/* Input samples converted at a time */
+#define RESAMPLE_BLOCK 256
+
+struct resampler_t {
+	int up;
+	int down;
+	float *coefs;     // for each phase, in the order of the input samples
+	float buf[RESAMPLE_TAPS - 1 + RESAMPLE_BLOCK];
+	int pos;          // index in buf of the last input of the next output
+	int phase;
+};
+
+static int gcd(int a, int b)
+{
+	int t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+struct resampler_t *new_resampler(int in_rate, int out_rate)
+{
+	struct resampler_t *r = allocMem(sizeof(struct resampler_t));
+	int g = gcd(in_rate, out_rate);
+	int len, p, k, j;
+	double fc, center, x, w, h;
+
+	r->up = out_rate / g;
+	r->down = in_rate / g;
+	r->coefs = allocMem(r->up * RESAMPLE_TAPS * sizeof(float));
+
+	/* The prototype filter runs at up times the input rate. */
+	len = r->up * RESAMPLE_TAPS;
+	center = (len - 1) / 2.0;
+	fc = 0.5 * RESAMPLE_CUTOFF / (r->up > r->down ? r->up : r->down);
+	for (p = 0; p < r->up; p++) {
+		for (k = 0; k < RESAMPLE_TAPS; k++) {
+			j = p + k * r->up;
+			x = j - center;
+			h = x == 0 ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+			// Blackman window
+			w = 0.42 - 0.5 * cos(2 * M_PI * j / (len - 1)) +
+			    0.08 * cos(4 * M_PI * j / (len - 1));
+			/* Tap k applies to the input k samples back, which is
+			 * stored RESAMPLE_TAPS - 1 - k places into the window of
+			 * input samples. */
+			r->coefs[p * RESAMPLE_TAPS + RESAMPLE_TAPS - 1 - k] =
+				h * w * r->up;
+		}
+	}
+	resampler_reset(r);
+	return r;
+}
+
+void free_resampler(struct resampler_t *r)
+{
+	free(r->coefs);
+	free(r);
+}
+
+/* Forget the past input, after a flush. */
+void resampler_reset(struct resampler_t *r)
+{
+	memset(r->buf, 0, sizeof(r->buf));
+	r->pos = RESAMPLE_TAPS - 1;
+	r->phase = 0;
+}
+
+/* Room needed for the output of n input samples */
+int resampler_max_output(struct resampler_t *r, int n)
+{
+	return (long) n * r->up / r->down + 2 * (n / RESAMPLE_BLOCK + 1);
+}
+
+/* Convert n samples.  Returns how many samples were written to out. */
+int resampler_process(struct resampler_t *r, const short *in, int n,
+                      short *out)
+{
+	const int hist = RESAMPLE_TAPS - 1;
+	int produced = 0;
+	int count, len, i;
+
+	while (n > 0) {
+		count = n < RESAMPLE_BLOCK ? n : RESAMPLE_BLOCK;
+		for (i = 0; i < count; i++)
+			r->buf[hist + i] = in[i];
+		len = hist + count;
+		while (r->pos < len) {
+			out[produced++] = clip_sample(
+				dot_product(r->coefs + r->phase * RESAMPLE_TAPS,
+			                r->buf + r->pos - hist, RESAMPLE_TAPS));
+			r->phase += r->down;
+			r->pos += r->phase / r->up;
+			r->phase %= r->up;
+		}
+		memmove(r->buf, r->buf + count, hist * sizeof(float));
+		r->pos -= count;
+		in += count;
+		n -= count;
+	}
+	return produced;
+}
+
+/* Delay through the filter, in input samples */
+double resampler_delay(struct resampler_t *r)
+{
+	return (r->up * RESAMPLE_TAPS - 1) / (2.0 * r->up);
+}
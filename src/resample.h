@@ -0,0 +1,33 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RESAMPLE_H
+#define __RESAMPLE_H
+
+struct resampler_t;     // An opaque type.
+
+extern struct resampler_t *new_resampler(int in_rate, int out_rate);
+extern void free_resampler(struct resampler_t *r);
+extern void resampler_reset(struct resampler_t *r);
+extern int resampler_max_output(struct resampler_t *r, int n);
+extern int resampler_process(struct resampler_t *r, const short *in, int n,
+                             short *out);
+extern double resampler_delay(struct resampler_t *r);
+
+#endif
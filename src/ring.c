@@ -0,0 +1,195 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Lock-free single-producer/single-consumer ring of samples, with the
+ * index marks which go along with them.  Synthesis produces, playback
+ * consumes.  Positions are counted in samples since the ring was
+ * created, and never wrap.
+ *
+ * The producer can flush the ring, by making the read positions jump to
+ * the write positions.  The consumer only advances its read positions
+ * with a compare-and-swap, so that a flush happening while it is playing
+ * a piece is never undone: it notices that the piece was flushed, and
+ * the flushed data is never played.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+#include "stringhandling.h"
+
+struct ring_mark_t {
+	uint64_t pos;
+	int value;
+};
+
+struct pcm_ring_t {
+	int size;          // in samples, a power of two
+	int nmarks;        // a power of two as well
+	short *samples;
+	struct ring_mark_t *marks;
+	/* Keep the producer and consumer positions on separate cache
+	 * lines. */
+	_Alignas(64) atomic_uint_fast64_t write;
+	atomic_uint_fast64_t mark_write;
+	_Alignas(64) atomic_uint_fast64_t read;
+	atomic_uint_fast64_t mark_read;
+	// Where the consumer peeked, only used by the consumer.
+	uint64_t peek_read;
+	uint64_t peek_mark_read;
+};
+
+static int round_up_pow2(int n)
+{
+	int p = 1;
+
+	while (p < n)
+		p <<= 1;
+	return p;
+}
+
+struct pcm_ring_t *new_pcm_ring(int samples, int marks)
+{
+	struct pcm_ring_t *r = allocMem(sizeof(struct pcm_ring_t));
+
+	r->size = round_up_pow2(samples);
+	r->nmarks = round_up_pow2(marks);
+	r->samples = allocMem(r->size * sizeof(short));
+	r->marks = allocMem(r->nmarks * sizeof(struct ring_mark_t));
+	atomic_init(&r->write, 0);
+	atomic_init(&r->mark_write, 0);
+	atomic_init(&r->read, 0);
+	atomic_init(&r->mark_read, 0);
+	r->peek_read = 0;
+	r->peek_mark_read = 0;
+	return r;
+}
+
+int pcm_ring_size(struct pcm_ring_t *r)
+{
+	return r->size;
+}
+
+/* Add as many samples as there is room for, returns how many. */
+int pcm_ring_write(struct pcm_ring_t *r, const short *samples, int n)
+{
+	uint64_t w = atomic_load_explicit(&r->write, memory_order_relaxed);
+	uint64_t rd = atomic_load_explicit(&r->read, memory_order_acquire);
+	int space = r->size - (int) (w - rd);
+	int offset = w & (r->size - 1);
+	int first;
+
+	if (n > space)
+		n = space;
+	first = r->size - offset;
+	if (first > n)
+		first = n;
+	memcpy(r->samples + offset, samples, first * sizeof(short));
+	memcpy(r->samples, samples + first, (n - first) * sizeof(short));
+	atomic_store_explicit(&r->write, w + n, memory_order_release);
+	return n;
+}
+
+/* Add a mark at the current write position.  Returns 0 if the marks are
+ * full. */
+int pcm_ring_add_mark(struct pcm_ring_t *r, int value)
+{
+	uint64_t w = atomic_load_explicit(&r->mark_write, memory_order_relaxed);
+	uint64_t rd = atomic_load_explicit(&r->mark_read, memory_order_acquire);
+	struct ring_mark_t *m;
+
+	if (w - rd >= (uint64_t) r->nmarks)
+		return 0;
+	m = &r->marks[w & (r->nmarks - 1)];
+	m->pos = atomic_load_explicit(&r->write, memory_order_relaxed);
+	m->value = value;
+	atomic_store_explicit(&r->mark_write, w + 1, memory_order_release);
+	return 1;
+}
+
+/* Drop everything not played yet. */
+void pcm_ring_flush(struct pcm_ring_t *r)
+{
+	atomic_store(&r->read, atomic_load(&r->write));
+	atomic_store(&r->mark_read, atomic_load(&r->mark_write));
+}
+
+/* Get the samples available for playing, in one piece. */
+int pcm_ring_peek(struct pcm_ring_t *r, const short **samples)
+{
+	uint64_t rd = atomic_load_explicit(&r->read, memory_order_relaxed);
+	uint64_t w = atomic_load_explicit(&r->write, memory_order_acquire);
+	int offset = rd & (r->size - 1);
+	int n = w - rd;
+
+	r->peek_read = rd;
+	if (n > r->size - offset)
+		n = r->size - offset;
+	*samples = r->samples + offset;
+	return n;
+}
+
+/* Release n samples obtained from the last pcm_ring_peek.  Returns 0 if
+ * they were flushed meanwhile. */
+int pcm_ring_consume(struct pcm_ring_t *r, int n)
+{
+	uint64_t rd = r->peek_read;
+
+	return atomic_compare_exchange_strong(&r->read, &rd, rd + n);
+}
+
+int pcm_ring_next_mark(struct pcm_ring_t *r, uint64_t *pos, int *value)
+{
+	uint64_t rd = atomic_load_explicit(&r->mark_read, memory_order_relaxed);
+	uint64_t w = atomic_load_explicit(&r->mark_write, memory_order_acquire);
+	struct ring_mark_t *m;
+
+	r->peek_mark_read = rd;
+	if (rd == w)
+		return 0;
+	m = &r->marks[rd & (r->nmarks - 1)];
+	*pos = m->pos;
+	*value = m->value;
+	return 1;
+}
+
+/* Release the mark obtained from pcm_ring_next_mark.  Returns 0 if it was
+ * flushed meanwhile, and is not to be reported. */
+int pcm_ring_pop_mark(struct pcm_ring_t *r)
+{
+	uint64_t rd = r->peek_mark_read;
+
+	return atomic_compare_exchange_strong(&r->mark_read, &rd, rd + 1);
+}
+
+uint64_t pcm_ring_read_pos(struct pcm_ring_t *r)
+{
+	return atomic_load(&r->read);
+}
+
+uint64_t pcm_ring_write_pos(struct pcm_ring_t *r)
+{
+	return atomic_load(&r->write);
+}
+
+int pcm_ring_fill(struct pcm_ring_t *r)
+{
+	return atomic_load(&r->write) - atomic_load(&r->read);
+}
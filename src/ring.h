@@ -0,0 +1,47 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RING_H
+#define __RING_H
+
+#include <stdint.h>
+
+struct pcm_ring_t;     // An opaque type.
+
+extern struct pcm_ring_t *new_pcm_ring(int samples, int marks);
+extern int pcm_ring_size(struct pcm_ring_t *r);
+
+/* Producer side */
+extern int pcm_ring_write(struct pcm_ring_t *r, const short *samples, int n);
+extern int pcm_ring_add_mark(struct pcm_ring_t *r, int value);
+extern void pcm_ring_flush(struct pcm_ring_t *r);
+
+/* Consumer side */
+extern int pcm_ring_peek(struct pcm_ring_t *r, const short **samples);
+extern int pcm_ring_consume(struct pcm_ring_t *r, int n);
+extern int pcm_ring_next_mark(struct pcm_ring_t *r, uint64_t *pos,
+                              int *value);
+extern int pcm_ring_pop_mark(struct pcm_ring_t *r);
+
+/* Either side */
+extern uint64_t pcm_ring_read_pos(struct pcm_ring_t *r);
+extern uint64_t pcm_ring_write_pos(struct pcm_ring_t *r);
+extern int pcm_ring_fill(struct pcm_ring_t *r);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Collapsing of runs of a repeated symbol, such as the lines of dashes or
+ * equal signs of tables and logs, which would otherwise be spoken symbol
+ * by symbol.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "runs.h"
+#include "stringhandling.h"
+
+/* Return the length of the symbol starting txt, or 0 if it is not a
+ * symbol: ASCII punctuation, or a character from the general punctuation
+ * to the miscellaneous symbols blocks (U+2000 to U+2BFF), which include
+ * arrows, box drawing and block elements. */
+static int symbol_length(const char *txt, size_t length)
+{
+	unsigned char c = txt[0];
+
+	if (c < 0x80)
+		return ispunct(c) ? 1 : 0;
+	if (c == 0xe2 && length >= 3 && (txt[1] & 0xc0) == 0x80 &&
+	    (unsigned char) txt[1] <= 0xaf && (txt[2] & 0xc0) == 0x80)
+		return 3;
+	return 0;
+}
+
+/* Rewrite the runs of more than max_run times the same symbol in txt.  If
+ * the symbols are spoken (all punctuation), a run becomes the symbol and
+ * its count, such as "= ×40", else the symbol once, for the pause.  If
+ * anything was rewritten, the result is appended to *out, and the number
+ * of runs is returned; else *out is left alone, and 0 is returned. */
+int collapse_runs(const char *txt, size_t length, int max_run, int spoken,
+                  char **out, int *out_l)
+{
+	size_t i = 0, done = 0, end;
+	int count = 0;
+	int l, n;
+	char num[16];
+
+	while (i < length) {
+		l = symbol_length(txt + i, length - i);
+		if (!l) {
+			i++;
+			continue;
+		}
+		n = 1;
+		for (end = i + l; end + l <= length &&
+		                  !memcmp(txt + end, txt + i, l); end += l)
+			n++;
+		if (n > max_run) {
+			stringAndBytes(out, out_l, txt + done, i - done);
+			if (spoken) {
+				stringAndString(out, out_l, " ");
+				stringAndBytes(out, out_l, txt + i, l);
+				snprintf(num, sizeof(num), " ×%d ", n);
+				stringAndString(out, out_l, num);
+			} else {
+				stringAndBytes(out, out_l, txt + i, l);
+			}
+			done = end;
+			count++;
+		}
+		i = end;
+	}
+	if (count)
+		stringAndBytes(out, out_l, txt + done, length - done);
+	return count;
+}
@@ -47,6 +47,7 @@ void *signal_thread(void *arg)
 	sigemptyset(&temp.sa_mask);
 	sigaction(SIGINT, &temp, NULL);
 	sigaction(SIGTERM, &temp, NULL);
+	sigaction(SIGHUP, &temp, NULL);
 
 	pthread_mutex_lock(&queue_guard);
 	while (should_run) {
@@ -68,6 +69,15 @@ void *signal_thread(void *arg)
 			pthread_cond_broadcast(&stop_acknowledged);
 			pthread_mutex_unlock(&queue_guard);
 			break;
+		case SIGHUP:
+			/* The espeak thread reloads the configuration, and the
+			 * softsynth thread the substitution dictionary. */
+			pthread_mutex_lock(&queue_guard);
+			reload_requested = 1;
+			reload_substitutions = 1;
+			pthread_cond_signal(&runner_awake);
+			pthread_mutex_unlock(&queue_guard);
+			break;
 		default:
 			printf("espeakup caught signal %d\n", sig);
 			break;
@@ -17,7 +17,7 @@
  *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <ctype.h>
+#define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -27,218 +27,177 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "engine.h"
 #include "espeakup.h"
+#include "parser.h"
+#include "pool.h"
+#include "probes.h"
+#include "realtime.h"
+#include "repeat.h"
+#include "stats.h"
 #include "stringhandling.h"
+#include "substitute.h"
 
-// max buffer size
-static const size_t maxBufferSize = 16 * 1024 + 1;
+static int softFD = 0;
 
-// synth flush character
-static const int synthFlushChar = 0x18;
+/* Substitution dictionary, applied to the text before it is queued.  It
+ * is read again on SIGHUP, by the softsynth thread before it parses more
+ * text. */
+char *substitutionsPath = NULL;
+static struct substitutions_t *substitutions = NULL;
+volatile int reload_substitutions = 0;
+
+/* Flush debouncing, for bursts of flushes such as a key held down: a
+ * flush coming less than flushDebounce milliseconds after the previous
+ * one stops speech, and what comes after it is held back until there was
+ * no flush for that long.  The next flushes of the burst merely drop what
+ * is held back, so that only the latest text gets synthesized. */
+int flushDebounce = 0;
+static long long last_flush = 0;
+static int holding = 0;
+static struct queue_t *held = NULL;
+
+/* Identifies the entries in the probes.  Under a supervisor, the entries
+ * come with their ids, as the data of the callbacks. */
+static unsigned long next_entry_id = 0;
+
+static unsigned long entry_id(void *data)
+{
+	return data ? *(unsigned long *) data : next_entry_id++;
+}
 
-static int softFD = 0;
+static void free_entry(struct espeak_entry_t *entry)
+{
+	if (entry->cmd == CMD_SPEAK_TEXT)
+		free(entry->buf);
+	free(entry);
+}
 
-// Text accumulator:
-char *textAccumulator;
-int textAccumulator_l;
+static void queue_entry(struct espeak_entry_t *entry)
+{
+	if (holding) {
+		queue_add(held, (void *) entry);
+		return;
+	}
+	pthread_mutex_lock(&queue_guard);
+	if (!queue_add(synth_queue, (void *) entry)) {
+		free_entry(entry);
+	} else {
+		PROBE3(enqueue, entry->id, entry->cmd,
+		       entry->cmd == CMD_SPEAK_TEXT ? entry->len : 0);
+		stats_add(STATS_SOFTSYNTH, STAT_ENTRIES_QUEUED, 1);
+		if (entry->cmd == CMD_SPEAK_TEXT)
+			stats_add(STATS_SOFTSYNTH, STAT_TEXT_QUEUED, entry->len);
+		pthread_cond_signal(&runner_awake);
+	}
+	pthread_mutex_unlock(&queue_guard);
+}
 
-static void queue_add_cmd(enum command_t cmd, enum adjust_t adj, int value)
+static void queue_add_cmd(void *data, enum command_t cmd, enum adjust_t adj,
+                          int value)
 {
 	struct espeak_entry_t *entry;
-	int added = 0;
 
 	entry = allocMem(sizeof(struct espeak_entry_t));
 	entry->cmd = cmd;
 	entry->adjust = adj;
 	entry->value = value;
-	pthread_mutex_lock(&queue_guard);
-	added = queue_add(synth_queue, (void *) entry);
-	if (!added)
-		free(entry);
-	else
-		pthread_cond_signal(&runner_awake);
-	pthread_mutex_unlock(&queue_guard);
+	entry->job = -1;
+	entry->id = entry_id(data);
+	queue_entry(entry);
 }
 
-static void queue_add_text(char *txt, size_t length)
+static void queue_add_text(void *data, const char *txt, size_t length)
 {
 	struct espeak_entry_t *entry;
-	int added = 0;
 
+	// Under a supervisor, it left the repeats out already.
+	if (!data) {
+		length = repeat_filter(txt, length);
+		if (!length)
+			return;
+	}
 	entry = allocMem(sizeof(struct espeak_entry_t));
 	entry->cmd = CMD_SPEAK_TEXT;
 	entry->adjust = ADJ_SET;
-	entry->buf = strdup(txt);
+	entry->job = -1;
+	entry->buf = strndup(txt, length);
 	if (!entry->buf) {
 		perror("unable to allocate space for text");
 		free(entry);
 		return;
 	}
 	entry->len = length;
-	pthread_mutex_lock(&queue_guard);
-	added = queue_add(synth_queue, (void *) entry);
-	if (!added) {
-		free(entry->buf);
-		free(entry);
-	} else {
-		pthread_cond_signal(&runner_awake);
-	}
-
-	pthread_mutex_unlock(&queue_guard);
+	entry->id = entry_id(data);
+	queue_entry(entry);
 }
 
-static int process_command(struct synth_t *s, char *buf, int start)
+static void drop_held(void)
 {
-	char *cp;
-	int value;
-	enum adjust_t adj;
-	enum command_t cmd;
-
-	cp = buf + start;
-	switch (*cp) {
-	case 1:
-		cp++;
-		switch (*cp) {
-		case '+':
-			adj = ADJ_INC;
-			cp++;
-			break;
-		case '-':
-			adj = ADJ_DEC;
-			cp++;
-			break;
-		default:
-			adj = ADJ_SET;
-			break;
-		}
-
-		value = 0;
-		while (isdigit(*cp)) {
-			value = value * 10 + (*cp - '0');
-			cp++;
-		}
-
-		switch (*cp) {
-		case 'b':
-			cmd = CMD_SET_PUNCTUATION;
-			break;
-		case 'f':
-			cmd = CMD_SET_FREQUENCY;
-			break;
-		case 'i':
-			cmd = CMD_SET_MARK;
-			break;
-		case 'p':
-			cmd = CMD_SET_PITCH;
-			break;
-		case 'r':
-			cmd = CMD_SET_RANGE;
-			break;
-		case 's':
-			cmd = CMD_SET_RATE;
-			break;
-		case 'v':
-			cmd = CMD_SET_VOLUME;
-			break;
-		case 'P':
-			cmd = CMD_PAUSE;
-			break;
-		default:
-			cmd = CMD_UNKNOWN;
-			break;
-		}
-		cp++;
-		break;
-	default:
-		cmd = CMD_UNKNOWN;
-		cp++;
-		break;
-	}
-
-	if (cmd != CMD_FLUSH && cmd != CMD_UNKNOWN) {
-		if (espeakup_mode == ESPEAKUP_MODE_ACSINT && textAccumulator_l != 0) {
-			queue_add_text(textAccumulator, textAccumulator_l);
-			free(textAccumulator);
-			textAccumulator = initString(&textAccumulator_l);
-		}
-		queue_add_cmd(cmd, adj, value);
-	}
-
-	return cp - (buf + start);
-}
+	struct espeak_entry_t *entry;
 
-static void process_buffer(struct synth_t *s, char *buf, ssize_t length)
-{
-	int start;
-	int end;
-	char txtBuf[maxBufferSize];
-	size_t txtLen;
-
-	start = 0;
-	end = 0;
-	while (start < length) {
-		while ((buf[end] < 0 || buf[end] >= ' ' || buf[end] == '\n') &&
-		       end < length)
-			end++;
-		if (end != start) {
-			txtLen = end - start;
-			strncpy(txtBuf, buf + start, txtLen);
-			*(txtBuf + txtLen) = 0;
-			queue_add_text(txtBuf, txtLen);
-		}
-		if (end < length)
-			start = end = end + process_command(s, buf, end);
-		else
-			start = length;
+	while ((entry = queue_remove(held))) {
+		stats_add(STATS_SOFTSYNTH, STAT_ENTRIES_COALESCED, 1);
+		free_entry(entry);
 	}
 }
 
-static void process_buffer_acsint(struct synth_t *s, char *buf, ssize_t length)
+/* Queue what was held back once the burst of flushes is over.  Returns
+ * how long until then in nanoseconds, or -1 if nothing is held back. */
+static long long release_held(void)
 {
-	int start = 0;
-	int i;
-	int flushIt = 0;
-
-	while (start < length) {
-		for (i = start; i < length; i++) {
-			if (buf[i] == '\r' || buf[i] == '\n')
-				flushIt = 1;
-			if (buf[i] >= 0 && buf[i] < ' ')
-				break;
-		}
-		if (i > start)
-			stringAndBytes(&textAccumulator, &textAccumulator_l, buf + start,
-			               i - start);
-		if (flushIt) {
-			if (textAccumulator != EMPTYSTRING) {
-				queue_add_text(textAccumulator, textAccumulator_l);
-				free(textAccumulator);
-				textAccumulator = initString(&textAccumulator_l);
-			}
-			flushIt = 0;
-		}
-		if (i < length)
-			start = i = i + process_command(s, buf, i);
-		else
-			start = length;
-	}
+	struct espeak_entry_t *entry;
+	long long left;
+
+	if (!holding)
+		return -1;
+	left = last_flush + flushDebounce * 1000000LL - monotonic_ns();
+	if (left > 0)
+		return left;
+	holding = 0;
+	while ((entry = queue_remove(held)))
+		queue_entry(entry);
+	return -1;
 }
 
 /* How long to wait for the espeak thread to acknowledge a stop request
- * before concluding that espeak is wedged beyond in-process recovery. */
-static const int stopAckTimeout = 10;
+ * before concluding that espeak is wedged beyond in-process recovery, in
+ * milliseconds. */
+int stopAckTimeout = 3000;
 
-static void request_espeak_stop(void)
+static void request_espeak_stop(void *data)
 {
 	struct timespec timeout;
+	long long now = monotonic_ns();
+	int burst = flushDebounce &&
+	            now - last_flush < flushDebounce * 1000000LL;
 	int err = 0;
 
+	stats_add(STATS_SOFTSYNTH, STAT_FLUSHES, 1);
+	last_flush = now;
+	repeat_flushed();
+	if (burst && holding) {
+		// Nothing was queued since the last flush: no need to stop.
+		stats_add(STATS_SOFTSYNTH, STAT_FLUSHES_COALESCED, 1);
+		drop_held();
+		return;
+	}
+	drop_held();
+	holding = burst;
+	PROBE0(flush_request);
 	pthread_mutex_lock(&queue_guard);
 	stop_requested = 1;
+	audio_stop_requested();
+	pool_interrupt();
 	pthread_cond_signal(&runner_awake);     // Wake runner, if necessary.
 	pthread_cond_signal(&wake_stop);        // Wake runner, if necessary.
 	clock_gettime(CLOCK_MONOTONIC, &timeout);
-	timeout.tv_sec += stopAckTimeout;
+	timeout.tv_sec += stopAckTimeout / 1000;
+	timeout.tv_nsec += stopAckTimeout % 1000 * 1000000L;
+	if (timeout.tv_nsec >= 1000000000L) {
+		timeout.tv_sec++;
+		timeout.tv_nsec -= 1000000000L;
+	}
 	while (should_run && stop_requested && err != ETIMEDOUT)
 		// wait for acknowledgement.
 		err = pthread_cond_timedwait(&stop_acknowledged, &queue_guard,
@@ -252,31 +211,77 @@ static void request_espeak_stop(void)
 		 * /dev/softsynth anymore.  Use _exit because exit could hang in
 		 * library destructors while the audio device is wedged. */
 		fprintf(stderr, "espeakup: espeak did not acknowledge a stop "
-		        "request within %d seconds, aborting\n", stopAckTimeout);
+		        "request within %d ms, aborting\n", stopAckTimeout);
 		_exit(3);
 	}
 	pthread_mutex_unlock(&queue_guard);
 }
 
+static const struct parser_callbacks_t queue_callbacks = {
+	.text = queue_add_text,
+	.command = queue_add_cmd,
+	.flush = request_espeak_stop,
+};
+
+int load_substitutions(void)
+{
+	struct substitutions_t *d;
+
+	if (!substitutionsPath)
+		return 0;
+	d = read_substitutions(substitutionsPath);
+	if (!d)
+		return -1;
+	if (debug)
+		fprintf(stderr, "%d substitutions in %s\n", substitutions_count(d),
+		        substitutionsPath);
+	if (substitutions)
+		free_substitutions(substitutions);
+	substitutions = d;
+	return 0;
+}
+
+// Read the substitution dictionary again, keeping it on failure.
+void reload_speech_parser(struct parser_t *parser)
+{
+	reload_substitutions = 0;
+	load_substitutions();
+	parser_set_substitutions(parser, substitutions);
+}
+
+/* A parser of the softsynth protocol, as spoken: in the mode we run in,
+ * and with the substitution dictionary. */
+struct parser_t *new_speech_parser(const struct parser_callbacks_t *cb,
+                                   void *data)
+{
+	struct parser_t *parser = new_parser(espeakup_mode, cb, data);
+
+	parser_set_substitutions(parser, substitutions);
+	return parser;
+}
+
+/* Returns the file descriptor to read from, or -1 on failure. */
 int open_softsynth(void)
 {
-	int rc = 0;
+	// Under a supervisor, the entries come from it.
+	if (engine_process()) {
+		softFD = engine_socket();
+		return softFD;
+	}
 	// If we're in acsint mode, we read from stdin.  No need to open.
 	if (espeakup_mode == ESPEAKUP_MODE_ACSINT) {
 		softFD = STDIN_FILENO;
-		return 0;
+		return softFD;
 	}
 
 	// open the softsynth.
-	softFD = open("/dev/softsynthu", O_RDWR | O_NONBLOCK);
+	softFD = open("/dev/softsynthu", O_RDWR | O_NONBLOCK | O_CLOEXEC);
 	if (softFD < 0 && errno == ENOENT)
 		// Kernel without unicode support? Try without unicode.
-		softFD = open("/dev/softsynth", O_RDWR | O_NONBLOCK);
-	if (softFD < 0) {
+		softFD = open("/dev/softsynth", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if (softFD < 0)
 		perror("Unable to open the /dev/softsynth device");
-		rc = -1;
-	}
-	return rc;
+	return softFD;
 }
 
 void close_softsynth(void)
@@ -287,15 +292,18 @@ void close_softsynth(void)
 
 void *softsynth_thread(void *arg)
 {
-	struct synth_t *s = (struct synth_t *) arg;
+	struct parser_t *parser;
 	fd_set set;
+	struct timeval tv;
+	struct timeval *timeout;
+	long long left;
 	ssize_t length;
-	char buf[maxBufferSize];
-	char *cp;
+	char buf[PARSER_MAX_INPUT];
 	int terminalFD = PIPE_READ_FD;
 	int greatestFD;
 
-	textAccumulator = initString(&textAccumulator_l);
+	parser = new_speech_parser(&queue_callbacks, NULL);
+	held = new_queue();
 
 	if (terminalFD > softFD)
 		greatestFD = terminalFD;
@@ -308,7 +316,16 @@ void *softsynth_thread(void *arg)
 		FD_SET(softFD, &set);
 		FD_SET(terminalFD, &set);
 
-		if (select(greatestFD + 1, &set, NULL, NULL, NULL) < 0) {
+		// Wake up at the end of a burst of flushes.
+		timeout = NULL;
+		left = release_held();
+		if (left >= 0) {
+			tv.tv_sec = left / 1000000000LL;
+			tv.tv_usec = left % 1000000000LL / 1000 + 1;
+			timeout = &tv;
+		}
+
+		if (select(greatestFD + 1, &set, NULL, NULL, timeout) < 0) {
 			if (errno == EINTR) {
 				pthread_mutex_lock(&queue_guard);
 				continue;
@@ -328,7 +345,22 @@ void *softsynth_thread(void *arg)
 			continue;
 		}
 
-		length = read(softFD, buf, maxBufferSize - 1);
+		if (engine_process()) {
+			length = engine_read(&queue_callbacks);
+			if (length < 0 && (errno == EAGAIN || errno == EINTR)) {
+				pthread_mutex_lock(&queue_guard);
+				continue;
+			}
+			if (length < 0)
+				perror("Read from the supervisor failed");
+			pthread_mutex_lock(&queue_guard);
+			// Or the supervisor is gone.
+			if (length <= 0)
+				break;
+			continue;
+		}
+
+		length = read(softFD, buf, sizeof(buf));
 		if (length < 0) {
 			if (errno == EAGAIN || errno == EINTR) {
 				pthread_mutex_lock(&queue_guard);
@@ -338,25 +370,23 @@ void *softsynth_thread(void *arg)
 			pthread_mutex_lock(&queue_guard);
 			break;
 		}
-		*(buf + length) = 0;
-		cp = strrchr(buf, synthFlushChar);
-		if (cp) {
-			request_espeak_stop();
-			memmove(buf, cp + 1, strlen(cp + 1) + 1);
-			length = strlen(buf);
-		}
-		if (espeakup_mode == ESPEAKUP_MODE_SPEAKUP)
-			process_buffer(s, buf, length);
-		else
-			process_buffer_acsint(s, buf, length);
+		stats_add(STATS_SOFTSYNTH, STAT_BYTES_READ, length);
+		PROBE1(read, length);
+		if (reload_substitutions)
+			reload_speech_parser(parser);
+		parser_feed(parser, buf, length);
 		pthread_mutex_lock(&queue_guard);
 	}
 	pthread_cond_signal(&runner_awake);
 	pthread_mutex_unlock(&queue_guard);
+	drop_held();
+	free(held);
+	free_parser(parser);
 	return NULL;
 }
 
-void softsynth_reportindex(int index)
+// Report an index mark to Speakup, or on the standard output.
+void softsynth_writeindex(int index)
 {
 	if (espeakup_mode == ESPEAKUP_MODE_ACSINT) {
 		putchar(index);
@@ -368,3 +398,19 @@ void softsynth_reportindex(int index)
 			perror("Writing index failed");
 	}
 }
+
+// Called from the playback thread.
+void softsynth_reportindex(int index)
+{
+	// An entry played, for the supervisor
+	if (index < 0) {
+		engine_report(index);
+		return;
+	}
+	stats_add(STATS_PLAYBACK, STAT_INDEX_REPORTS, 1);
+	PROBE1(mark, index);
+	if (engine_process())
+		engine_report(index);
+	else
+		softsynth_writeindex(index);
+}
@@ -0,0 +1,455 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "espeakup.h"
+#include "realtime.h"
+#include "stats.h"
+
+/* UNIX socket to serve the stats on, or NULL */
+char *statsSocket = NULL;
+
+/* File to write the stats to periodically, or NULL */
+char *statsFile = NULL;
+
+/* How often to write the stats file, in seconds */
+int statsInterval = 10;
+
+static struct stats_block_t local_stats[STATS_THREADS];
+struct stats_block_t *thread_stats = local_stats;
+static int shared_fd = -1;
+
+/* Rates are measured over this period, in seconds */
+#define RATE_PERIOD 10
+
+struct snapshot_t {
+	long long time;
+	unsigned long bytes;
+	unsigned long entries;
+};
+
+static struct snapshot_t history[RATE_PERIOD + 1];
+static int history_len = 0;
+static long long start_time;
+
+int stats_enabled(void)
+{
+	return statsSocket || statsFile;
+}
+
+/* Move the counters to memory which the engine processes map as well,
+ * given stats_shared_fd, so that they update those the supervisor
+ * serves. */
+int stats_share(void)
+{
+	void *p;
+	int fd = memfd_create("espeakup-stats", MFD_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, sizeof(local_stats)) < 0) {
+		close(fd);
+		return -1;
+	}
+	p = mmap(NULL, sizeof(local_stats), PROT_READ | PROT_WRITE, MAP_SHARED,
+	         fd, 0);
+	if (p == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	memcpy(p, local_stats, sizeof(local_stats));
+	thread_stats = p;
+	shared_fd = fd;
+	return 0;
+}
+
+// The memory of the shared counters, or -1 if they are not shared.
+int stats_shared_fd(void)
+{
+	return shared_fd;
+}
+
+// In an engine process, count in the memory the supervisor shared.
+int stats_attach(int fd)
+{
+	void *p = mmap(NULL, sizeof(local_stats), PROT_READ | PROT_WRITE,
+	               MAP_SHARED, fd, 0);
+
+	close(fd);
+	if (p == MAP_FAILED)
+		return -1;
+	thread_stats = p;
+	return 0;
+}
+
+static unsigned long counter(enum stats_thread_t t, enum stat_t s)
+{
+	return stats_get(t, s);
+}
+
+static void take_snapshot(void)
+{
+	if (history_len == RATE_PERIOD + 1) {
+		memmove(history, history + 1, RATE_PERIOD * sizeof(history[0]));
+		history_len--;
+	}
+	history[history_len].time = monotonic_ns();
+	history[history_len].bytes = counter(STATS_SOFTSYNTH, STAT_BYTES_READ);
+	history[history_len].entries = counter(STATS_ESPEAK, STAT_ENTRIES_DONE);
+	history_len++;
+}
+
+static double rate(unsigned long first, unsigned long last, double secs)
+{
+	return secs > 0 ? (last - first) / secs : 0.0;
+}
+
+static long process_resident_kib(const char *pid)
+{
+	char path[64];
+	long size, resident;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%s/statm", pid);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+		resident = -1;
+	fclose(f);
+	if (resident < 0)
+		return -1;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static pid_t parent_pid(const char *pid)
+{
+	char path[64];
+	char line[512];
+	char *p = NULL;
+	int ppid;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%s/stat", pid);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	// The command name in parentheses may contain spaces.
+	if (fgets(line, sizeof(line), f))
+		p = strrchr(line, ')');
+	fclose(f);
+	if (!p || sscanf(p + 1, " %*c %d", &ppid) != 1)
+		return -1;
+	return ppid;
+}
+
+/* With --standby, the engine processes do the work and take the memory:
+ * their resident memory is added to that of the supervisor.  Their
+ * synthesis workers are left out, as they are without --standby. */
+static long resident_kib(void)
+{
+	long kib = process_resident_kib("self");
+	struct dirent *e;
+	DIR *d;
+
+	if (kib < 0 || !standbyTimeout)
+		return kib;
+	d = opendir("/proc");
+	if (!d)
+		return kib;
+	while ((e = readdir(d))) {
+		long engine_kib;
+
+		if (!isdigit((unsigned char) e->d_name[0]) ||
+		    parent_pid(e->d_name) != getpid())
+			continue;
+		engine_kib = process_resident_kib(e->d_name);
+		if (engine_kib > 0)
+			kib += engine_kib;
+	}
+	closedir(d);
+	return kib;
+}
+
+/* Record the calling thread as the one doing the work counted in block
+ * t.  With --standby, this is the thread of the engine which last did
+ * it. */
+void stats_claim_thread(enum stats_thread_t t)
+{
+	stats_set(t, STAT_THREAD_ID, thread_id());
+}
+
+static double ms(unsigned long ns)
+{
+	return ns / 1e6;
+}
+
+static double average_ms(unsigned long total_ns, unsigned long count)
+{
+	return count ? ms(total_ns) / count : 0.0;
+}
+
+/* The page faults and the scheduling delay of the thread doing the work
+ * counted in block t, all 0 before it did any. */
+static int format_thread(char *buf, size_t size, const char *name,
+                         enum stats_thread_t t)
+{
+	struct thread_usage_t u;
+	long tid = counter(t, STAT_THREAD_ID);
+
+	if (!tid || thread_usage(tid, &u) < 0)
+		memset(&u, 0, sizeof(u));
+	return snprintf(buf, size,
+	                "%s_thread_major_faults: %lu\n"
+	                "%s_thread_minor_faults: %lu\n"
+	                "%s_thread_scheduling_delay_ms: %.3f\n"
+	                "%s_thread_scheduling_delay_average_ms: %.3f\n",
+	                name, u.major_faults, name, u.minor_faults,
+	                name, ms(u.delay_ns),
+	                name, average_ms(u.delay_ns, u.timeslices));
+}
+
+/* Format the stats as "key: value" lines. */
+static int format_stats(char *buf, size_t size)
+{
+	struct snapshot_t *first = &history[0];
+	struct snapshot_t *last = &history[history_len - 1];
+	double secs = (last->time - first->time) / 1e9;
+	unsigned long queued = counter(STATS_SOFTSYNTH, STAT_ENTRIES_QUEUED);
+	unsigned long done = counter(STATS_ESPEAK, STAT_ENTRIES_DONE);
+	unsigned long text_queued = counter(STATS_SOFTSYNTH, STAT_TEXT_QUEUED);
+	unsigned long text_done = counter(STATS_ESPEAK, STAT_TEXT_DONE);
+	unsigned long synths = counter(STATS_ESPEAK, STAT_SYNTH_CALLS);
+	int len;
+
+	/* The counters are read one by one while being updated: the queue
+	 * depth may be transiently off by the entry being handed over. */
+	len = snprintf(buf, size,
+	               "uptime_seconds: %lld\n"
+	               "queue_entries: %ld\n"
+	               "queue_text_bytes: %ld\n"
+	               "memory_resident_kib: %ld\n"
+	               "bytes_read: %lu\n"
+	               "bytes_per_second: %.1f\n"
+	               "entries_processed: %lu\n"
+	               "entries_per_second: %.1f\n"
+	               "synth_calls: %lu\n"
+	               "synth_average_ms: %.3f\n"
+	               "synth_max_ms: %.3f\n"
+	               "buffer_full_retries: %lu\n"
+	               "stalled_retries: %lu\n"
+	               "restart_attempts: %lu\n"
+	               "engine_restarts: %lu\n"
+	               "flushes: %lu\n"
+	               "flushes_coalesced: %lu\n"
+	               "entries_coalesced: %lu\n"
+	               "repeats_dropped: %lu\n"
+	               "repeats_shortened: %lu\n"
+	               "repeat_bytes_saved: %lu\n"
+	               "wasted_synths: %lu\n"
+	               "wasted_synth_cpu_ms: %.3f\n"
+	               "synthesis_workers: %lu\n"
+	               "synthesis_workers_lost: %lu\n"
+	               "time_to_silence_average_ms: %.3f\n"
+	               "time_to_silence_max_ms: %.3f\n"
+	               "index_reports: %lu\n"
+	               "samples_played: %lu\n"
+	               "idle_periods: %lu\n"
+	               "wakeup_to_audio_average_ms: %.3f\n"
+	               "wakeup_to_audio_max_ms: %.3f\n"
+	               "device_failovers: %lu\n"
+	               "device_failover_average_ms: %.3f\n"
+	               "device_failover_max_ms: %.3f\n"
+	               "engine_failovers: %lu\n"
+	               "engine_switch_average_ms: %.3f\n"
+	               "engine_switch_max_ms: %.3f\n"
+	               "entries_replayed: %lu\n",
+	               (last->time - start_time) / 1000000000LL,
+	               (long) (queued - done),
+	               (long) (text_queued - text_done),
+	               resident_kib(),
+	               last->bytes, rate(first->bytes, last->bytes, secs),
+	               last->entries, rate(first->entries, last->entries, secs),
+	               synths,
+	               average_ms(counter(STATS_ESPEAK, STAT_SYNTH_NS), synths),
+	               ms(counter(STATS_ESPEAK, STAT_SYNTH_MAX_NS)),
+	               counter(STATS_ESPEAK, STAT_BUFFER_FULL),
+	               counter(STATS_ESPEAK, STAT_STALLED_RETRIES),
+	               counter(STATS_ESPEAK, STAT_RESTART_ATTEMPTS),
+	               counter(STATS_ESPEAK, STAT_ENGINE_RESTARTS),
+	               counter(STATS_SOFTSYNTH, STAT_FLUSHES),
+	               counter(STATS_SOFTSYNTH, STAT_FLUSHES_COALESCED),
+	               counter(STATS_SOFTSYNTH, STAT_ENTRIES_COALESCED),
+	               counter(STATS_SOFTSYNTH, STAT_REPEATS_DROPPED),
+	               counter(STATS_SOFTSYNTH, STAT_REPEATS_SHORTENED),
+	               counter(STATS_SOFTSYNTH, STAT_REPEAT_TEXT_SAVED),
+	               counter(STATS_ESPEAK, STAT_WASTED_SYNTHS),
+	               ms(counter(STATS_ESPEAK, STAT_WASTED_SYNTH_NS)),
+	               counter(STATS_ESPEAK, STAT_WORKERS),
+	               counter(STATS_ESPEAK, STAT_WORKERS_LOST),
+	               average_ms(counter(STATS_PLAYBACK, STAT_SILENCE_NS),
+	                          counter(STATS_PLAYBACK, STAT_SILENCED)),
+	               ms(counter(STATS_PLAYBACK, STAT_SILENCE_MAX_NS)),
+	               counter(STATS_PLAYBACK, STAT_INDEX_REPORTS),
+	               counter(STATS_PLAYBACK, STAT_SAMPLES_PLAYED),
+	               counter(STATS_ESPEAK, STAT_IDLE_PERIODS),
+	               average_ms(counter(STATS_PLAYBACK, STAT_WAKEUP_NS),
+	                          counter(STATS_PLAYBACK, STAT_WAKEUPS)),
+	               ms(counter(STATS_PLAYBACK, STAT_WAKEUP_MAX_NS)),
+	               counter(STATS_PLAYBACK, STAT_FAILOVERS),
+	               average_ms(counter(STATS_PLAYBACK, STAT_FAILOVER_NS),
+	                          counter(STATS_PLAYBACK, STAT_FAILOVERS)),
+	               ms(counter(STATS_PLAYBACK, STAT_FAILOVER_MAX_NS)),
+	               counter(STATS_SUPERVISOR, STAT_ENGINE_FAILOVERS),
+	               average_ms(counter(STATS_SUPERVISOR, STAT_ENGINE_SWITCH_NS),
+	                          counter(STATS_SUPERVISOR, STAT_ENGINE_FAILOVERS)),
+	               ms(counter(STATS_SUPERVISOR, STAT_ENGINE_SWITCH_MAX_NS)),
+	               counter(STATS_SUPERVISOR, STAT_ENTRIES_REPLAYED));
+	if (len < (int) size)
+		len += format_thread(buf + len, size - len, "synthesis",
+		                     STATS_ESPEAK);
+	if (len < (int) size)
+		len += format_thread(buf + len, size - len, "playback",
+		                     STATS_PLAYBACK);
+	if (len >= (int) size)
+		len = size - 1;
+	return len;
+}
+
+static int open_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Stats socket path %s is too long\n", path);
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("Unable to create the stats socket");
+		return -1;
+	}
+	// A stale socket from a previous run would make bind fail.
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+	    listen(fd, 4) < 0) {
+		fprintf(stderr, "Unable to listen on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void serve_client(int listen_fd, char *buf, size_t size)
+{
+	int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	int len;
+
+	if (fd < 0)
+		return;
+	len = format_stats(buf, size);
+	/* The report is small enough for the socket buffer; a client which
+	 * does not read it just misses it. */
+	(void) send(fd, buf, len, MSG_NOSIGNAL);
+	close(fd);
+}
+
+static void write_file(const char *path, const char *tmp, char *buf,
+                       size_t size)
+{
+	int len = format_stats(buf, size);
+	int fd;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return;
+	// Readers get either the previous report or this one, in full.
+	if (write(fd, buf, len) != len) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	close(fd);
+	if (rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+void *stats_thread(void *arg)
+{
+	char buf[4096];
+	struct pollfd pfd = {.fd = -1, .events = POLLIN };
+	char *tmp = NULL;
+	long long next_write;
+
+	// The file is written next to it, then renamed over it.
+	if (statsFile && asprintf(&tmp, "%s.tmp", statsFile) < 0) {
+		perror("Unable to allocate the stats file path");
+		tmp = NULL;
+	}
+	start_time = monotonic_ns();
+	next_write = start_time;
+	take_snapshot();
+	if (statsSocket)
+		pfd.fd = open_socket(statsSocket);
+
+	// Wake up every second, to sample the rates and notice shutdown.
+	while (should_run) {
+		long long now = monotonic_ns();
+		int timeout = 1000 - (now - history[history_len - 1].time) / 1000000;
+
+		if (timeout <= 0) {
+			take_snapshot();
+			timeout = 1000;
+		}
+		if (tmp && now >= next_write) {
+			write_file(statsFile, tmp, buf, sizeof(buf));
+			next_write = now + statsInterval * 1000000000LL;
+		}
+		if (poll(&pfd, 1, timeout) > 0)
+			serve_client(pfd.fd, buf, sizeof(buf));
+	}
+
+	if (pfd.fd >= 0) {
+		close(pfd.fd);
+		unlink(statsSocket);
+	}
+	if (statsFile)
+		unlink(statsFile);
+	free(tmp);
+	return NULL;
+}
@@ -0,0 +1,133 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdatomic.h>
+
+/* Live metrics.  Each thread only updates its own block of counters,
+ * which sits on cache lines of its own, with plain relaxed loads and
+ * stores, so that updating them costs next to nothing.  The stats thread
+ * reads them and serves them as text. */
+
+enum stats_thread_t
+{
+	STATS_SOFTSYNTH,
+	STATS_ESPEAK,
+	STATS_PLAYBACK,
+	STATS_SUPERVISOR,
+	STATS_THREADS,
+};
+
+enum stat_t
+{
+	/* softsynth thread */
+	STAT_BYTES_READ,
+	STAT_ENTRIES_QUEUED,
+	STAT_TEXT_QUEUED,
+	STAT_FLUSHES,
+	STAT_FLUSHES_COALESCED,
+	STAT_ENTRIES_COALESCED,
+	STAT_REPEATS_DROPPED,
+	STAT_REPEATS_SHORTENED,
+	STAT_REPEAT_TEXT_SAVED,
+	/* espeak thread */
+	STAT_ENTRIES_DONE,
+	STAT_TEXT_DONE,
+	STAT_SYNTH_CALLS,
+	STAT_SYNTH_NS,
+	STAT_SYNTH_MAX_NS,
+	STAT_BUFFER_FULL,
+	STAT_STALLED_RETRIES,
+	STAT_RESTART_ATTEMPTS,
+	STAT_ENGINE_RESTARTS,
+	STAT_IDLE_PERIODS,
+	STAT_WASTED_SYNTHS,
+	STAT_WASTED_SYNTH_NS,
+	STAT_WORKERS,
+	STAT_WORKERS_LOST,
+	/* playback thread */
+	STAT_INDEX_REPORTS,
+	STAT_SILENCED,
+	STAT_SILENCE_NS,
+	STAT_SILENCE_MAX_NS,
+	STAT_SAMPLES_PLAYED,
+	STAT_WAKEUPS,
+	STAT_WAKEUP_NS,
+	STAT_WAKEUP_MAX_NS,
+	STAT_FAILOVERS,
+	STAT_FAILOVER_NS,
+	STAT_FAILOVER_MAX_NS,
+	/* supervisor, with --standby */
+	STAT_ENGINE_FAILOVERS,
+	STAT_ENGINE_SWITCH_NS,
+	STAT_ENGINE_SWITCH_MAX_NS,
+	STAT_ENTRIES_REPLAYED,
+	/* every thread: the one doing the work, for its page faults and
+	 * scheduling delay */
+	STAT_THREAD_ID,
+	STAT_COUNT,
+};
+
+struct stats_block_t {
+	_Alignas(64) atomic_ulong value[STAT_COUNT];
+};
+
+extern struct stats_block_t *thread_stats;
+
+extern char *statsSocket;
+extern char *statsFile;
+extern int statsInterval;
+
+extern int stats_enabled(void);
+extern int stats_share(void);
+extern int stats_shared_fd(void);
+extern int stats_attach(int fd);
+extern void stats_claim_thread(enum stats_thread_t t);
+extern void *stats_thread(void *arg);
+
+static inline void stats_set(enum stats_thread_t t, enum stat_t s,
+                             unsigned long v)
+{
+	atomic_store_explicit(&thread_stats[t].value[s], v, memory_order_relaxed);
+}
+
+static inline unsigned long stats_get(enum stats_thread_t t, enum stat_t s)
+{
+	return atomic_load_explicit(&thread_stats[t].value[s],
+	                            memory_order_relaxed);
+}
+
+/* Only the owner thread updates a counter: no atomic read-modify-write
+ * is needed. */
+static inline void stats_add(enum stats_thread_t t, enum stat_t s,
+                             unsigned long n)
+{
+	stats_set(t, s, stats_get(t, s) + n);
+}
+
+static inline void stats_max(enum stats_thread_t t, enum stat_t s,
+                             unsigned long v)
+{
+	if (v > stats_get(t, s))
+		stats_set(t, s, v);
+}
+
+#endif
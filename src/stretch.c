@@ -0,0 +1,213 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Time compression, for speech faster than espeak's top rate, with the
+ * pitch kept.  This is WSOLA (waveform similarity overlap-add): frames
+ * are taken from the input every tempo * hop samples and overlap-added
+ * every hop samples, each frame being shifted by up to a few
+ * milliseconds so that it best matches the natural continuation of the
+ * previous one.
+ *
+ * The inner loops work on floats, so that the compiler can vectorize
+ * them.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsp.h"
+#include "stretch.h"
+#include "stringhandling.h"
+
+struct stretch_t {
+	int hop;           // synthesis hop, in samples
+	int frame;         // twice the hop
+	int tolerance;     // how far a frame may be shifted
+	double tempo;
+	float *window;
+
+	/* Input, from absolute position in_base on */
+	float *in;
+	int in_len;
+	int in_size;
+	long in_base;
+	long in_end;       // end of the real input once draining, else -1
+
+	double nominal;    // where the next frame would be taken from
+	long prev;         // where the previous frame was taken from, or -1
+
+	/* Overlap-add accumulator, and the samples completed from it */
+	float *acc;
+	short *ready;
+	int ready_len;
+	int ready_pos;
+	int done;
+};
+
+struct stretch_t *new_stretch(int rate)
+{
+	struct stretch_t *st = allocMem(sizeof(struct stretch_t));
+	int i;
+
+	memset(st, 0, sizeof(struct stretch_t));
+	// 10ms hops, shifts of up to 5ms
+	st->hop = rate / 100;
+	st->frame = 2 * st->hop;
+	st->tolerance = st->hop / 2;
+	st->window = allocMem(st->frame * sizeof(float));
+	for (i = 0; i < st->frame; i++)
+		st->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / st->frame);
+	st->in_size = 4 * st->frame;
+	st->in = allocMem(st->in_size * sizeof(float));
+	st->acc = allocMem(st->frame * sizeof(float));
+	st->ready = allocMem(st->frame * sizeof(short));
+	stretch_start(st, 1.0);
+	return st;
+}
+
+/* Start a new utterance, sped up by tempo. */
+void stretch_start(struct stretch_t *st, double tempo)
+{
+	st->tempo = tempo;
+	st->in_len = 0;
+	st->in_base = 0;
+	st->in_end = -1;
+	st->nominal = st->tolerance;
+	st->prev = -1;
+	memset(st->acc, 0, st->frame * sizeof(float));
+	st->ready_len = st->ready_pos = 0;
+	st->done = 0;
+}
+
+static void append(struct stretch_t *st, const short *samples, int n)
+{
+	int i;
+
+	if (st->in_len + n > st->in_size) {
+		st->in_size = (st->in_len + n) * 2;
+		st->in = reallocMem(st->in, st->in_size * sizeof(float));
+	}
+	if (samples)
+		for (i = 0; i < n; i++)
+			st->in[st->in_len + i] = samples[i];
+	else
+		memset(st->in + st->in_len, 0, n * sizeof(float));
+	st->in_len += n;
+}
+
+void stretch_put(struct stretch_t *st, const short *samples, int n)
+{
+	append(st, samples, n);
+}
+
+/* The utterance is complete: let the rest of it out. */
+void stretch_drain(struct stretch_t *st)
+{
+	st->in_end = st->in_base + st->in_len;
+	// Room for the last frame, however it gets shifted.
+	append(st, NULL, st->frame + 2 * st->tolerance + st->hop);
+}
+
+/* Where to take the next frame from, in the input buffer. */
+static int best_offset(struct stretch_t *st)
+{
+	int nominal = (long) st->nominal - st->in_base;
+	const float *natural;
+	float best, c;
+	int offset, delta;
+
+	if (st->prev < 0)
+		return nominal;
+	natural = st->in + (st->prev + st->hop - st->in_base);
+	offset = nominal - st->tolerance;
+	best = dot_product(natural, st->in + offset, st->frame);
+	for (delta = -st->tolerance + 1; delta <= st->tolerance; delta++) {
+		c = dot_product(natural, st->in + nominal + delta, st->frame);
+		if (c > best) {
+			best = c;
+			offset = nominal + delta;
+		}
+	}
+	return offset;
+}
+
+/* Overlap-add one more frame, completing hop samples.  Returns 0 if more
+ * input is needed first. */
+static int add_frame(struct stretch_t *st)
+{
+	long need;
+	long keep;
+	int offset, i;
+
+	if (st->in_end >= 0 && (long) st->nominal >= st->in_end) {
+		st->done = 1;
+		return 0;
+	}
+	need = (long) st->nominal + st->tolerance + st->frame;
+	if (st->prev >= 0 && st->prev + st->hop + st->frame > need)
+		need = st->prev + st->hop + st->frame;
+	if (need > st->in_base + st->in_len)
+		return 0;
+
+	offset = best_offset(st);
+	for (i = 0; i < st->frame; i++)
+		st->acc[i] += st->window[i] * st->in[offset + i];
+	for (i = 0; i < st->hop; i++)
+		st->ready[i] = clip_sample(st->acc[i]);
+	memmove(st->acc, st->acc + st->hop, st->hop * sizeof(float));
+	memset(st->acc + st->hop, 0, st->hop * sizeof(float));
+	st->ready_len = st->hop;
+	st->ready_pos = 0;
+	st->prev = st->in_base + offset;
+	st->nominal += st->tempo * st->hop;
+
+	// Drop the input which is not needed anymore.
+	keep = (long) st->nominal - st->tolerance;
+	if (st->prev + st->hop < keep)
+		keep = st->prev + st->hop;
+	keep -= st->in_base;
+	if (keep > 0) {
+		memmove(st->in, st->in + keep, (st->in_len - keep) * sizeof(float));
+		st->in_len -= keep;
+		st->in_base += keep;
+	}
+	return 1;
+}
+
+/* Get up to max samples of output.  Returns 0 when more input is needed,
+ * or when the drained utterance is complete. */
+int stretch_get(struct stretch_t *st, short *samples, int max)
+{
+	int n = 0;
+	int count;
+
+	while (n < max) {
+		if (st->ready_pos == st->ready_len) {
+			if (st->done || !add_frame(st))
+				break;
+		}
+		count = st->ready_len - st->ready_pos;
+		if (count > max - n)
+			count = max - n;
+		memcpy(samples + n, st->ready + st->ready_pos, count * sizeof(short));
+		st->ready_pos += count;
+		n += count;
+	}
+	return n;
+}
@@ -0,0 +1,31 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STRETCH_H
+#define __STRETCH_H
+
+struct stretch_t;     // An opaque type.
+
+extern struct stretch_t *new_stretch(int rate);
+extern void stretch_start(struct stretch_t *st, double tempo);
+extern void stretch_put(struct stretch_t *st, const short *samples, int n);
+extern void stretch_drain(struct stretch_t *st);
+extern int stretch_get(struct stretch_t *st, short *samples, int max);
+
+#endif
@@ -0,0 +1,404 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Substitution dictionary for the console text: a list of strings to
+ * replace, compiled into an Aho-Corasick automaton so that the text is
+ * scanned once, however many rules there are.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stringhandling.h"
+#include "substitute.h"
+
+/* A state of the automaton: the trie node for the longest suffix of the
+ * text scanned so far which is a prefix of some pattern.  Its edges are
+ * sorted, except for the root which has a table of all 256. */
+struct ac_node_t {
+	int fail;        // node of the longest proper suffix in the trie
+	int out;         // node of the longest suffix which is a pattern, or 0
+	int rule;        // rule whose pattern ends here, or -1
+	int depth;
+	int edges;       // first edge
+	int nedges;
+};
+
+struct ac_edge_t {
+	unsigned char c;
+	int next;
+};
+
+struct rule_t {
+	char *replacement;
+	int length;
+};
+
+struct substitutions_t {
+	struct ac_node_t *nodes;
+	int nnodes;
+	struct ac_edge_t *edges;
+	int root[256];
+	struct rule_t *rules;
+	int nrules;
+};
+
+/* While building: edges are kept in lists, to be sorted once complete. */
+struct build_edge_t {
+	unsigned char c;
+	int next;
+	int sibling;
+};
+
+struct builder_t {
+	struct substitutions_t *d;
+	int *first;           // first edge of each node
+	int nodes_size;
+	struct build_edge_t *edges;
+	int nedges;
+	int edges_size;
+};
+
+static int build_child(struct builder_t *b, int node, unsigned char c)
+{
+	int e;
+
+	for (e = b->first[node]; e >= 0; e = b->edges[e].sibling)
+		if (b->edges[e].c == c)
+			return b->edges[e].next;
+	return -1;
+}
+
+static int add_node(struct builder_t *b, int depth)
+{
+	struct substitutions_t *d = b->d;
+
+	if (d->nnodes == b->nodes_size) {
+		b->nodes_size *= 2;
+		d->nodes = reallocMem(d->nodes,
+		                      b->nodes_size * sizeof(struct ac_node_t));
+		b->first = reallocMem(b->first, b->nodes_size * sizeof(int));
+	}
+	memset(&d->nodes[d->nnodes], 0, sizeof(struct ac_node_t));
+	d->nodes[d->nnodes].rule = -1;
+	d->nodes[d->nnodes].depth = depth;
+	b->first[d->nnodes] = -1;
+	return d->nnodes++;
+}
+
+static void add_pattern(struct builder_t *b, const char *pattern, int length,
+                        int rule)
+{
+	int node = 0;
+	int i, next;
+
+	for (i = 0; i < length; i++) {
+		next = build_child(b, node, pattern[i]);
+		if (next < 0) {
+			next = add_node(b, i + 1);
+			if (b->nedges == b->edges_size) {
+				b->edges_size *= 2;
+				b->edges = reallocMem(b->edges, b->edges_size *
+				                      sizeof(struct build_edge_t));
+			}
+			b->edges[b->nedges].c = pattern[i];
+			b->edges[b->nedges].next = next;
+			b->edges[b->nedges].sibling = b->first[node];
+			b->first[node] = b->nedges++;
+		}
+		node = next;
+	}
+	// The last rule for a pattern wins.
+	b->d->nodes[node].rule = rule;
+}
+
+static int compare_edges(const void *a, const void *b)
+{
+	return ((const struct ac_edge_t *) a)->c -
+	       ((const struct ac_edge_t *) b)->c;
+}
+
+static int find_edge(struct substitutions_t *d, int node, unsigned char c)
+{
+	struct ac_node_t *n = &d->nodes[node];
+	int lo = n->edges, hi = n->edges + n->nedges;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (d->edges[mid].c < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo < n->edges + n->nedges && d->edges[lo].c == c)
+		return d->edges[lo].next;
+	return -1;
+}
+
+static int child(struct substitutions_t *d, int node, unsigned char c)
+{
+	if (node == 0)
+		return d->root[c];
+	return find_edge(d, node, c);
+}
+
+static int step(struct substitutions_t *d, int node, unsigned char c)
+{
+	int next;
+
+	while ((next = child(d, node, c)) < 0)
+		node = d->nodes[node].fail;
+	return next;
+}
+
+/* Sort the edges, and compute the failure links breadth first, so that
+ * those of shallower nodes are known when needed. */
+static void compile(struct builder_t *b)
+{
+	struct substitutions_t *d = b->d;
+	int *queue = allocMem(d->nnodes * sizeof(int));
+	int head = 0, tail = 0;
+	int node, e, n, c;
+
+	d->edges = allocMem((b->nedges ? b->nedges : 1) *
+	                    sizeof(struct ac_edge_t));
+	n = 0;
+	for (node = 0; node < d->nnodes; node++) {
+		d->nodes[node].edges = n;
+		for (e = b->first[node]; e >= 0; e = b->edges[e].sibling) {
+			d->edges[n].c = b->edges[e].c;
+			d->edges[n].next = b->edges[e].next;
+			n++;
+		}
+		d->nodes[node].nedges = n - d->nodes[node].edges;
+		qsort(d->edges + d->nodes[node].edges, d->nodes[node].nedges,
+		      sizeof(struct ac_edge_t), compare_edges);
+	}
+
+	// The root never fails: it stays put on characters it has no edge for.
+	for (c = 0; c < 256; c++) {
+		n = find_edge(d, 0, c);
+		d->root[c] = n >= 0 ? n : 0;
+		if (n >= 0)
+			queue[tail++] = n;
+	}
+	while (head < tail) {
+		struct ac_node_t *p;
+
+		node = queue[head++];
+		p = &d->nodes[node];
+		for (e = p->edges; e < p->edges + p->nedges; e++) {
+			struct ac_node_t *ch = &d->nodes[d->edges[e].next];
+			ch->fail = step(d, p->fail, d->edges[e].c);
+			ch->out = d->nodes[ch->fail].rule >= 0 ? ch->fail
+			                                       : d->nodes[ch->fail].out;
+			queue[tail++] = d->edges[e].next;
+		}
+	}
+	free(queue);
+}
+
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* Undo the escapes of a field in place, returns its new length. */
+static int unescape(char *s)
+{
+	char *in = s, *out = s;
+
+	while (*in) {
+		if (*in != '\\' || !in[1]) {
+			*out++ = *in++;
+			continue;
+		}
+		in++;
+		switch (*in) {
+		case 't':
+			*out++ = '\t';
+			in++;
+			break;
+		case 'n':
+			*out++ = '\n';
+			in++;
+			break;
+		case 'x':
+			if (hex_digit(in[1]) >= 0 && hex_digit(in[2]) >= 0) {
+				*out++ = hex_digit(in[1]) * 16 + hex_digit(in[2]);
+				in += 3;
+				break;
+			}
+			// fall through
+		default:
+			*out++ = *in++;
+			break;
+		}
+	}
+	*out = 0;
+	return out - s;
+}
+
+/* Read a dictionary: one rule per line, the text to replace and its
+ * replacement separated by tabs, with \t, \n, \\ and \xHH escapes.
+ * Blank lines and lines starting with # are ignored.  Returns NULL if the
+ * file cannot be read. */
+struct substitutions_t *read_substitutions(const char *path)
+{
+	struct substitutions_t *d;
+	struct builder_t b;
+	FILE *f;
+	char line[1024];
+	int rules_size = 16;
+	int lineno = 0;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Unable to read %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+
+	d = allocMem(sizeof(struct substitutions_t));
+	memset(d, 0, sizeof(struct substitutions_t));
+	d->rules = allocMem(rules_size * sizeof(struct rule_t));
+	b.d = d;
+	b.nodes_size = 64;
+	d->nodes = allocMem(b.nodes_size * sizeof(struct ac_node_t));
+	b.first = allocMem(b.nodes_size * sizeof(int));
+	b.edges_size = 64;
+	b.edges = allocMem(b.edges_size * sizeof(struct build_edge_t));
+	b.nedges = 0;
+	add_node(&b, 0);
+
+	while (fgets(line, sizeof(line), f)) {
+		char *pattern = line;
+		char *replacement;
+		int length;
+
+		lineno++;
+		line[strcspn(line, "\r\n")] = 0;
+		if (!*line || *line == '#')
+			continue;
+		replacement = line + strcspn(line, "\t");
+		if (*replacement) {
+			*replacement++ = 0;
+			replacement += strspn(replacement, "\t");
+		}
+		length = unescape(pattern);
+		if (!length) {
+			fprintf(stderr, "%s:%d: empty text to replace\n", path, lineno);
+			continue;
+		}
+		if (d->nrules == rules_size) {
+			rules_size *= 2;
+			d->rules = reallocMem(d->rules,
+			                      rules_size * sizeof(struct rule_t));
+		}
+		d->rules[d->nrules].length = unescape(replacement);
+		d->rules[d->nrules].replacement =
+			allocMem(d->rules[d->nrules].length + 1);
+		memcpy(d->rules[d->nrules].replacement, replacement,
+		       d->rules[d->nrules].length + 1);
+		add_pattern(&b, pattern, length, d->nrules);
+		d->nrules++;
+	}
+	fclose(f);
+
+	compile(&b);
+	free(b.first);
+	free(b.edges);
+	return d;
+}
+
+void free_substitutions(struct substitutions_t *d)
+{
+	int i;
+
+	for (i = 0; i < d->nrules; i++)
+		free(d->rules[i].replacement);
+	free(d->rules);
+	free(d->nodes);
+	free(d->edges);
+	free(d);
+}
+
+int substitutions_count(struct substitutions_t *d)
+{
+	return d->nrules;
+}
+
+/* Apply the dictionary to txt.  Where several patterns match, the one
+ * starting first wins, and then the longest.  If anything was replaced,
+ * the result is appended to *out, and the number of replacements is
+ * returned; else *out is left alone, and 0 is returned.
+ *
+ * A match is only replaced once no longer one starting as early can still
+ * come up, that is once the automaton tracks a partial match starting
+ * after it.  Scanning then resumes after the match, going over at most
+ * the length of the longest pattern again. */
+int substitute(struct substitutions_t *d, const char *txt, size_t length,
+               char **out, int *out_l)
+{
+	size_t i = 0, done = 0;
+	size_t best_start = 0, best_length = 0;
+	int best_rule = -1;
+	int node = 0;
+	int count = 0;
+
+	while (i < length || best_rule >= 0) {
+		if (i < length) {
+			struct ac_node_t *n;
+			int m;
+
+			node = step(d, node, txt[i++]);
+			n = &d->nodes[node];
+			// The longest pattern ending here is the one starting first.
+			m = n->rule >= 0 ? node : n->out;
+			if (m) {
+				size_t l = d->nodes[m].depth;
+				if (best_rule < 0 || i - l < best_start ||
+				    (i - l == best_start && l > best_length)) {
+					best_start = i - l;
+					best_length = l;
+					best_rule = d->nodes[m].rule;
+				}
+			}
+			if (best_rule < 0 ||
+			    i - d->nodes[node].depth <= best_start)
+				continue;
+		}
+		stringAndBytes(out, out_l, txt + done, best_start - done);
+		stringAndBytes(out, out_l, d->rules[best_rule].replacement,
+		               d->rules[best_rule].length);
+		count++;
+		done = i = best_start + best_length;
+		node = 0;
+		best_rule = -1;
+	}
+	if (count)
+		stringAndBytes(out, out_l, txt + done, length - done);
+	return count;
+}
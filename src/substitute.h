@@ -0,0 +1,33 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SUBSTITUTE_H
+#define __SUBSTITUTE_H
+
+#include <stddef.h>
+
+struct substitutions_t;     // An opaque type.
+
+extern struct substitutions_t *read_substitutions(const char *path);
+extern void free_substitutions(struct substitutions_t *d);
+extern int substitutions_count(struct substitutions_t *d);
+extern int substitute(struct substitutions_t *d, const char *txt,
+                      size_t length, char **out, int *out_l);
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ * Silence trimming.  Espeak pads every utterance with silence, which for
+ * key echo and cursor movement is most of the perceived latency.  This
+ * drops the leading silence of an utterance, and shortens every pause,
+ * the trailing one included, to a maximum length.
+ *
+ * Samples are looked at in short frames: a frame is silent when its mean
+ * energy is below a threshold.
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "trim.h"
+
+/* About 1.5ms at 22050Hz */
+#define TRIM_FRAME 32
+
+/* amplitude is the RMS amplitude below which audio is silence, and
+ * max_pause the silence kept at most, in samples. */
+void trim_init(struct trim_t *t, int amplitude, int max_pause)
+{
+	memset(t, 0, sizeof(struct trim_t));
+	t->threshold = (long long) amplitude * amplitude;
+	t->max_pause = max_pause;
+}
+
+/* Start a new utterance, trimmed or not. */
+void trim_start(struct trim_t *t, int active)
+{
+	t->active = active;
+	t->in_sound = 0;
+	t->silence = 0;
+}
+
+/* Copy the samples to keep from in to out, which must have room for n
+ * samples.  Returns how many were kept. */
+int trim_samples(struct trim_t *t, const short *in, int n, short *out)
+{
+	int kept = 0;
+	int i, j, len, keep;
+	long long energy;
+
+	if (!t->active) {
+		memcpy(out, in, n * sizeof(short));
+		return n;
+	}
+	for (i = 0; i < n; i += len) {
+		len = n - i < TRIM_FRAME ? n - i : TRIM_FRAME;
+		energy = 0;
+		for (j = 0; j < len; j++)
+			energy += in[i + j] * in[i + j];
+		if (energy >= t->threshold * len) {
+			t->in_sound = 1;
+			t->silence = 0;
+			keep = len;
+		} else if (!t->in_sound) {
+			keep = 0;
+		} else {
+			keep = t->max_pause - t->silence;
+			if (keep < 0)
+				keep = 0;
+			if (keep > len)
+				keep = len;
+			if (t->silence <= t->max_pause)
+				t->silence += len;
+		}
+		memcpy(out + kept, in + i, keep * sizeof(short));
+		kept += keep;
+		t->trimmed += len - keep;
+	}
+	return kept;
+}
@@ -0,0 +1,38 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TRIM_H
+#define __TRIM_H
+
+/* Silence trimming of a stream of samples, one utterance at a time. */
+struct trim_t {
+	int active;
+	long long threshold;     // mean square below which a frame is silent
+	int max_pause;      // silence kept at most, in samples
+	int in_sound;       // past the leading silence
+	int silence;        // length of the current silence, in samples
+	long trimmed;       // samples dropped since trim_init
+};
+
+extern void trim_init(struct trim_t *t, int amplitude, int max_pause);
+extern void trim_start(struct trim_t *t, int active);
+extern int trim_samples(struct trim_t *t, const short *in, int n,
+                        short *out);
+
+#endif
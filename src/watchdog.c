@@ -0,0 +1,157 @@
+/*
+ *  espeakup - interface which allows speakup to use espeak-ng
+ *
+ *  Copyright (C) 2008 William Hubbs
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Service manager notifications and watchdog, speaking the sd_notify
+ * protocol directly rather than linking with libsystemd: a datagram of
+ * "VARIABLE=value" lines sent to the socket named by $NOTIFY_SOCKET.
+ *
+ * When the service has WatchdogSec= set, a heartbeat is sent regularly,
+ * but only as long as speech is making progress: the espeak thread is
+ * idle, or audio keeps being synthesized or played.  When the espeak
+ * thread has been stuck in a call into espeak-ng for longer than
+ * stallTimeout, which the in-process recovery cannot do anything about,
+ * the watchdog is triggered so that the service manager restarts us. */
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "espeakup.h"
+#include "realtime.h"
+#include "watchdog.h"
+
+static struct sockaddr_un notify_addr;
+static socklen_t notify_len = 0;
+static long long watchdog_ns = 0;
+static int watchdog_enabled = 0;
+
+/* When the espeak thread entered espeak-ng, 0 while it is idle */
+static atomic_llong busy_since = 0;
+/* When audio was last synthesized or played */
+static atomic_llong last_progress = 0;
+
+/* Called before daemonizing: systemd gives the watchdog to the process
+ * it started, which is the one checking WATCHDOG_PID. */
+int watchdog_init(void)
+{
+	const char *socket_path = getenv("NOTIFY_SOCKET");
+	const char *usec = getenv("WATCHDOG_USEC");
+	const char *pid = getenv("WATCHDOG_PID");
+	size_t len;
+
+	if (!socket_path || (socket_path[0] != '/' && socket_path[0] != '@'))
+		return 0;
+	len = strlen(socket_path);
+	if (len >= sizeof(notify_addr.sun_path))
+		return 0;
+	memset(&notify_addr, 0, sizeof(notify_addr));
+	notify_addr.sun_family = AF_UNIX;
+	memcpy(notify_addr.sun_path, socket_path, len);
+	// A leading @ stands for the abstract namespace.
+	if (notify_addr.sun_path[0] == '@')
+		notify_addr.sun_path[0] = 0;
+	notify_len = offsetof(struct sockaddr_un, sun_path) + len;
+
+	if (usec && (!pid || atoi(pid) == getpid()))
+		watchdog_ns = atoll(usec) * 1000LL;
+	watchdog_enabled = watchdog_ns > 0;
+	return watchdog_enabled;
+}
+
+void watchdog_notify(const char *state)
+{
+	int fd;
+
+	if (!notify_len)
+		return;
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+	(void) sendto(fd, state, strlen(state), MSG_NOSIGNAL,
+	              (struct sockaddr *) &notify_addr, notify_len);
+	close(fd);
+}
+
+/* The espeak thread enters or leaves espeak-ng. */
+void watchdog_busy(int busy)
+{
+	if (watchdog_enabled)
+		atomic_store_explicit(&busy_since, busy ? monotonic_ns() : 0,
+		                      memory_order_relaxed);
+}
+
+/* Audio was synthesized or played. */
+void watchdog_progress(void)
+{
+	if (watchdog_enabled)
+		atomic_store_explicit(&last_progress, monotonic_ns(),
+		                      memory_order_relaxed);
+}
+
+/* How long the espeak thread has been stuck, in ns. */
+static long long stuck_time(long long now)
+{
+	long long since = atomic_load_explicit(&busy_since, memory_order_relaxed);
+	long long progress =
+		atomic_load_explicit(&last_progress, memory_order_relaxed);
+
+	if (!since)
+		return 0;
+	if (progress > since)
+		since = progress;
+	return now - since;
+}
+
+void *watchdog_thread(void *arg)
+{
+	struct timespec period;
+	long long period_ns = watchdog_ns / 4;
+	int triggered = 0;
+
+	if (!watchdog_enabled)
+		return NULL;
+	// Check often enough to trigger soon after stallTimeout.
+	if (period_ns > 250000000LL)
+		period_ns = 250000000LL;
+	period.tv_sec = period_ns / 1000000000LL;
+	period.tv_nsec = period_ns % 1000000000LL;
+
+	while (should_run) {
+		long long stuck = stuck_time(monotonic_ns());
+
+		if (stuck < stallTimeout * 1000000LL) {
+			watchdog_notify("WATCHDOG=1");
+			triggered = 0;
+		} else if (!triggered) {
+			fprintf(stderr, "espeakup: espeak has been stuck for %lld ms, "
+			        "triggering the watchdog\n", stuck / 1000000);
+			watchdog_notify("WATCHDOG=trigger");
+			triggered = 1;
+		}
+		nanosleep(&period, NULL);
+	}
+	watchdog_notify("STOPPING=1");
+	return NULL;
+}